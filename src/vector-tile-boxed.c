@@ -20,12 +20,18 @@
 
 #include <vector-tile-boxed.h>
 #include <vector-tile-mapbox.h>
+#include <vector-tile-mapbox-label-cache.h>
+#include <vector-tile-mapbox-label-registry.h>
+#include <vector-tile-mapbox-render-plan.h>
+
+#include "vector-tile-mapbox-private.h"
 
 static VTileMapCSSStyle *
 vtile_mapcss_style_copy (const VTileMapCSSStyle *src)
 {
   VTileMapCSSStyle *dest = g_new (VTileMapCSSStyle, 1);
   dest->properties = g_hash_table_ref (src->properties);
+  dest->rules = src->rules ? vtile_mapcss_rules_ref (src->rules) : NULL;
 
   return dest;
 }
@@ -36,6 +42,12 @@ vtile_mapbox_text_copy (const VTileMapboxText *src)
   VTileMapboxText *dest = g_new (VTileMapboxText, 1);
 
   memcpy (dest, src, sizeof (VTileMapboxText));
+  if (src->surface)
+    dest->surface = cairo_surface_reference (src->surface);
+  dest->uid = g_strdup (src->uid);
+  dest->text = g_strdup (src->text);
+  if (src->lazy)
+    dest->lazy = vtile_mapbox_lazy_label_ref (src->lazy);
   return dest;
 }
 
@@ -61,3 +73,8 @@ G_DEFINE_BOXED_TYPE (VTileMapCSSStyle, vtile_mapcss_style, vtile_mapcss_style_co
 G_DEFINE_BOXED_TYPE (VTileMapCSSColor, vtile_mapcss_color, vtile_mapcss_color_copy, g_free)
 G_DEFINE_BOXED_TYPE (VTileMapCSSDash, vtile_mapcss_dash, vtile_mapcss_dash_copy, g_free)
 G_DEFINE_BOXED_TYPE (VTileMapboxText, vtile_mapbox_text, vtile_mapbox_text_copy, vtile_mapbox_text_free)
+G_DEFINE_BOXED_TYPE (VTileMapboxTile, vtile_mapbox_tile, vtile_mapbox_tile_ref, vtile_mapbox_tile_unref)
+G_DEFINE_BOXED_TYPE (VTileMapboxRenderContext, vtile_mapbox_render_context, vtile_mapbox_render_context_ref, vtile_mapbox_render_context_unref)
+G_DEFINE_BOXED_TYPE (VTileMapboxLabelCache, vtile_mapbox_label_cache, vtile_mapbox_label_cache_ref, vtile_mapbox_label_cache_unref)
+G_DEFINE_BOXED_TYPE (VTileMapboxLabelRegistry, vtile_mapbox_label_registry, vtile_mapbox_label_registry_ref, vtile_mapbox_label_registry_unref)
+G_DEFINE_BOXED_TYPE (VTileMapboxRenderPlan, vtile_mapbox_render_plan, vtile_mapbox_render_plan_ref, vtile_mapbox_render_plan_unref)
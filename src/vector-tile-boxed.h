@@ -57,6 +57,21 @@ GType vtile_mapcss_dash_get_type (void);
 GType vtile_mapcss_style_get_type (void);
 #define VTILE_TYPE_MAPCSS_STYLE (vtile_mapcss_style_get_type);
 
+GType vtile_mapbox_tile_get_type (void);
+#define VTILE_TYPE_MAPBOX_TILE (vtile_mapbox_tile_get_type ())
+
+GType vtile_mapbox_render_context_get_type (void);
+#define VTILE_TYPE_MAPBOX_RENDER_CONTEXT (vtile_mapbox_render_context_get_type ())
+
+GType vtile_mapbox_label_cache_get_type (void);
+#define VTILE_TYPE_MAPBOX_LABEL_CACHE (vtile_mapbox_label_cache_get_type ())
+
+GType vtile_mapbox_label_registry_get_type (void);
+#define VTILE_TYPE_MAPBOX_LABEL_REGISTRY (vtile_mapbox_label_registry_get_type ())
+
+GType vtile_mapbox_render_plan_get_type (void);
+#define VTILE_TYPE_MAPBOX_RENDER_PLAN (vtile_mapbox_render_plan_get_type ())
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "vector-tile-label-atlas.h"
+
+/*
+ * A shelf packer for label atlases. Rectangles are put side by side on
+ * horizontal shelves, a new shelf is opened below the last one when no
+ * shelf has room and a new page when the page is full. Labels are all
+ * about the same height, so adding them tallest first wastes little
+ * space. Only the last page is packed, earlier pages are full.
+ */
+
+/* Keep labels apart so that filtering does not bleed between them */
+#define LABEL_ATLAS_PADDING 1
+
+/* Do not put a rectangle on a shelf much taller than itself */
+#define LABEL_ATLAS_SHELF_FIT 0.7
+
+typedef struct {
+  gint y;
+  gint height;
+  gint used;
+} LabelAtlasShelf;
+
+typedef struct {
+  gint width;
+  gint height;
+  GArray *shelves;
+} LabelAtlasPage;
+
+struct _VTileLabelAtlas {
+  gint page_size;
+  GArray *pages;
+};
+
+static void
+label_atlas_page_clear (LabelAtlasPage *page)
+{
+  g_array_free (page->shelves, TRUE);
+}
+
+VTileLabelAtlas *
+vtile_label_atlas_new (gint page_size)
+{
+  VTileLabelAtlas *atlas;
+
+  atlas = g_new0 (VTileLabelAtlas, 1);
+  atlas->page_size = page_size;
+  atlas->pages = g_array_new (FALSE, FALSE, sizeof (LabelAtlasPage));
+  g_array_set_clear_func (atlas->pages,
+                          (GDestroyNotify) label_atlas_page_clear);
+
+  return atlas;
+}
+
+void
+vtile_label_atlas_free (VTileLabelAtlas *atlas)
+{
+  g_array_free (atlas->pages, TRUE);
+  g_free (atlas);
+}
+
+static LabelAtlasPage *
+label_atlas_add_page (VTileLabelAtlas *atlas)
+{
+  LabelAtlasPage page;
+
+  page.width = 0;
+  page.height = 0;
+  page.shelves = g_array_new (FALSE, FALSE, sizeof (LabelAtlasShelf));
+  g_array_append_val (atlas->pages, page);
+
+  return &g_array_index (atlas->pages, LabelAtlasPage, atlas->pages->len - 1);
+}
+
+/*
+ * Find room for a @width by @height rectangle. Returns the page it
+ * was put on and its position on the page in @x and @y. Rectangles
+ * larger than the page size get a page of their own.
+ */
+guint
+vtile_label_atlas_add (VTileLabelAtlas *atlas,
+                       gint width,
+                       gint height,
+                       gint *x,
+                       gint *y)
+{
+  LabelAtlasPage *page = NULL;
+  LabelAtlasShelf *shelf = NULL;
+  gint padded_width = width + LABEL_ATLAS_PADDING;
+  gint padded_height = height + LABEL_ATLAS_PADDING;
+  guint i;
+
+  if (atlas->pages->len > 0) {
+    page = &g_array_index (atlas->pages, LabelAtlasPage,
+                           atlas->pages->len - 1);
+
+    for (i = 0; i < page->shelves->len; i++) {
+      LabelAtlasShelf *s = &g_array_index (page->shelves, LabelAtlasShelf, i);
+
+      if (s->height >= padded_height &&
+          padded_height >= s->height * LABEL_ATLAS_SHELF_FIT &&
+          s->used + padded_width <= atlas->page_size) {
+        shelf = s;
+        break;
+      }
+    }
+
+    if (!shelf && (page->height + padded_height > atlas->page_size ||
+                   padded_width > atlas->page_size))
+      page = NULL;
+  }
+
+  if (!page)
+    page = label_atlas_add_page (atlas);
+
+  if (!shelf) {
+    LabelAtlasShelf s;
+
+    s.y = page->height;
+    s.height = padded_height;
+    s.used = 0;
+    g_array_append_val (page->shelves, s);
+    shelf = &g_array_index (page->shelves, LabelAtlasShelf,
+                            page->shelves->len - 1);
+    page->height += padded_height;
+  }
+
+  *x = shelf->used;
+  *y = shelf->y;
+  shelf->used += padded_width;
+  page->width = MAX (page->width, shelf->used);
+
+  return atlas->pages->len - 1;
+}
+
+guint
+vtile_label_atlas_get_n_pages (VTileLabelAtlas *atlas)
+{
+  return atlas->pages->len;
+}
+
+/* The part of @page that is in use, without the trailing padding */
+void
+vtile_label_atlas_get_page_size (VTileLabelAtlas *atlas,
+                                 guint page,
+                                 gint *width,
+                                 gint *height)
+{
+  LabelAtlasPage *p = &g_array_index (atlas->pages, LabelAtlasPage, page);
+
+  *width = MAX (1, p->width - LABEL_ATLAS_PADDING);
+  *height = MAX (1, p->height - LABEL_ATLAS_PADDING);
+}
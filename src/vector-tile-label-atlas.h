@@ -0,0 +1,44 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_LABEL_ATLAS_H__
+#define __VECTOR_TILE_LABEL_ATLAS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _VTileLabelAtlas VTileLabelAtlas;
+
+VTileLabelAtlas *vtile_label_atlas_new (gint page_size);
+void vtile_label_atlas_free (VTileLabelAtlas *atlas);
+
+guint vtile_label_atlas_add (VTileLabelAtlas *atlas,
+                             gint width,
+                             gint height,
+                             gint *x,
+                             gint *y);
+
+guint vtile_label_atlas_get_n_pages (VTileLabelAtlas *atlas);
+void vtile_label_atlas_get_page_size (VTileLabelAtlas *atlas,
+                                      guint page,
+                                      gint *width,
+                                      gint *height);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_LABEL_ATLAS_H__ */
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <math.h>
+
+#include "vector-tile-label-grid.h"
+
+/*
+ * A uniform grid of the labels placed on a tile. Each cell lists the
+ * labels whose bounding box touches it, so a new label is only tested
+ * against its neighbours. Boxes outside the grid are kept in the border
+ * cells, which keeps the lookups correct for labels that stick out of
+ * the tile.
+ */
+typedef struct {
+  VTileLabelBox box;
+  gdouble min_x, min_y;
+  gdouble max_x, max_y;
+} LabelGridEntry;
+
+struct _VTileLabelGrid {
+  gint cell_size;
+  gint n_cols;
+  gint n_rows;
+
+  GPtrArray **cells;
+  GPtrArray *entries;
+};
+
+VTileLabelGrid *
+vtile_label_grid_new (gint width,
+                      gint height,
+                      gint cell_size)
+{
+  VTileLabelGrid *grid;
+
+  grid = g_new0 (VTileLabelGrid, 1);
+  grid->cell_size = cell_size;
+  grid->n_cols = MAX (1, (width + cell_size - 1) / cell_size);
+  grid->n_rows = MAX (1, (height + cell_size - 1) / cell_size);
+  grid->cells = g_new0 (GPtrArray *, grid->n_cols * grid->n_rows);
+  grid->entries = g_ptr_array_new_with_free_func (g_free);
+
+  return grid;
+}
+
+void
+vtile_label_grid_free (VTileLabelGrid *grid)
+{
+  gint i;
+
+  for (i = 0; i < grid->n_cols * grid->n_rows; i++) {
+    if (grid->cells[i])
+      g_ptr_array_free (grid->cells[i], TRUE);
+  }
+
+  g_free (grid->cells);
+  g_ptr_array_free (grid->entries, TRUE);
+  g_free (grid);
+}
+
+static gint
+label_grid_cell (gdouble pos,
+                 gint cell_size,
+                 gint n_cells)
+{
+  return CLAMP ((gint) floor (pos / cell_size), 0, n_cells - 1);
+}
+
+/*
+ * Project the corners of @box on the axis (@ax, @ay) and return the
+ * smallest and largest values.
+ */
+static void
+label_box_project (const VTileLabelBox *box,
+                   gdouble ax,
+                   gdouble ay,
+                   gdouble *min,
+                   gdouble *max)
+{
+  gint i;
+
+  *min = *max = box->x[0] * ax + box->y[0] * ay;
+  for (i = 1; i < 4; i++) {
+    gdouble p = box->x[i] * ax + box->y[i] * ay;
+
+    *min = MIN (*min, p);
+    *max = MAX (*max, p);
+  }
+}
+
+/*
+ * Two rectangles overlap unless one of their edge normals separates
+ * them. Rectangles only have two edge directions each.
+ */
+static gboolean
+label_box_overlaps (const VTileLabelBox *a,
+                    const VTileLabelBox *b)
+{
+  const VTileLabelBox *boxes[] = { a, b };
+  gint i, j;
+
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 2; j++) {
+      const VTileLabelBox *box = boxes[i];
+      gdouble ax = box->y[j] - box->y[j + 1];
+      gdouble ay = box->x[j + 1] - box->x[j];
+      gdouble a_min, a_max, b_min, b_max;
+
+      label_box_project (a, ax, ay, &a_min, &a_max);
+      label_box_project (b, ax, ay, &b_min, &b_max);
+      if (a_max <= b_min || b_max <= a_min)
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+label_box_get_extents (const VTileLabelBox *box,
+                       gdouble *min_x,
+                       gdouble *min_y,
+                       gdouble *max_x,
+                       gdouble *max_y)
+{
+  gint i;
+
+  *min_x = *max_x = box->x[0];
+  *min_y = *max_y = box->y[0];
+  for (i = 1; i < 4; i++) {
+    *min_x = MIN (*min_x, box->x[i]);
+    *max_x = MAX (*max_x, box->x[i]);
+    *min_y = MIN (*min_y, box->y[i]);
+    *max_y = MAX (*max_y, box->y[i]);
+  }
+}
+
+/* Returns %TRUE if @box overlaps a box on the grid */
+gboolean
+vtile_label_grid_collides (VTileLabelGrid *grid,
+                           const VTileLabelBox *box)
+{
+  gdouble min_x, min_y, max_x, max_y;
+  gint col_start, col_end, row_start, row_end;
+  gint col, row;
+
+  label_box_get_extents (box, &min_x, &min_y, &max_x, &max_y);
+
+  col_start = label_grid_cell (min_x, grid->cell_size, grid->n_cols);
+  col_end = label_grid_cell (max_x, grid->cell_size, grid->n_cols);
+  row_start = label_grid_cell (min_y, grid->cell_size, grid->n_rows);
+  row_end = label_grid_cell (max_y, grid->cell_size, grid->n_rows);
+
+  for (row = row_start; row <= row_end; row++) {
+    for (col = col_start; col <= col_end; col++) {
+      GPtrArray *cell = grid->cells[row * grid->n_cols + col];
+      guint j;
+
+      if (!cell)
+        continue;
+
+      for (j = 0; j < cell->len; j++) {
+        LabelGridEntry *placed = g_ptr_array_index (cell, j);
+
+        if (placed->max_x <= min_x || max_x <= placed->min_x ||
+            placed->max_y <= min_y || max_y <= placed->min_y)
+          continue;
+
+        if (label_box_overlaps (&placed->box, box))
+          return TRUE;
+      }
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * Place @box on the grid unless it overlaps a box placed before.
+ * Returns %TRUE if the box was placed.
+ */
+gboolean
+vtile_label_grid_insert (VTileLabelGrid *grid,
+                         const VTileLabelBox *box)
+{
+  LabelGridEntry *entry;
+  gdouble min_x, min_y, max_x, max_y;
+  gint col_start, col_end, row_start, row_end;
+  gint col, row;
+
+  if (vtile_label_grid_collides (grid, box))
+    return FALSE;
+
+  label_box_get_extents (box, &min_x, &min_y, &max_x, &max_y);
+
+  col_start = label_grid_cell (min_x, grid->cell_size, grid->n_cols);
+  col_end = label_grid_cell (max_x, grid->cell_size, grid->n_cols);
+  row_start = label_grid_cell (min_y, grid->cell_size, grid->n_rows);
+  row_end = label_grid_cell (max_y, grid->cell_size, grid->n_rows);
+
+  entry = g_new (LabelGridEntry, 1);
+  entry->box = *box;
+  entry->min_x = min_x;
+  entry->min_y = min_y;
+  entry->max_x = max_x;
+  entry->max_y = max_y;
+  g_ptr_array_add (grid->entries, entry);
+
+  for (row = row_start; row <= row_end; row++) {
+    for (col = col_start; col <= col_end; col++) {
+      GPtrArray **cell = &grid->cells[row * grid->n_cols + col];
+
+      if (!*cell)
+        *cell = g_ptr_array_new ();
+      g_ptr_array_add (*cell, entry);
+    }
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_LABEL_GRID_H__
+#define __VECTOR_TILE_LABEL_GRID_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The corners of a, possibly rotated, label rectangle in order */
+typedef struct {
+  gdouble x[4];
+  gdouble y[4];
+} VTileLabelBox;
+
+typedef struct _VTileLabelGrid VTileLabelGrid;
+
+VTileLabelGrid *vtile_label_grid_new (gint width,
+                                      gint height,
+                                      gint cell_size);
+void vtile_label_grid_free (VTileLabelGrid *grid);
+
+gboolean vtile_label_grid_collides (VTileLabelGrid *grid,
+                                    const VTileLabelBox *box);
+gboolean vtile_label_grid_insert (VTileLabelGrid *grid,
+                                  const VTileLabelBox *box);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_LABEL_GRID_H__ */
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "vector-tile-mapbox-label-cache.h"
+#include "vector-tile-mapbox-private.h"
+
+/**
+ * SECTION:vector-tile-mapbox-label-cache
+ * @short_description: Cache of rendered labels
+ *
+ * The same street and place names show up on many neighbouring tiles
+ * and at several zoom levels. A #VTileMapboxLabelCache keeps the
+ * rendered label surfaces, keyed by the text, the font, the text and
+ * halo colours, the halo radius and the angle, so a repeated label
+ * costs a lookup instead of a text layout and rasterisation.
+ *
+ * The cache holds at most the given number of bytes of pixel data and
+ * drops the least recently used labels when it is full. It can be used
+ * from several threads at once. Render contexts use the cache returned
+ * by vtile_mapbox_label_cache_get_default() unless told otherwise.
+ */
+
+#define DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+  VTileMapboxLabelKey key;
+  VTileMapboxLabel label;
+  gsize size;
+  GList link;
+} LabelCacheEntry;
+
+struct _VTileMapboxLabelCache {
+  volatile gint ref_count;
+
+  GMutex lock;
+  GHashTable *entries;
+  GQueue lru;
+  gsize size;
+  gsize max_size;
+};
+
+guint
+vtile_mapbox_text_style_hash (gconstpointer data)
+{
+  const VTileMapboxTextStyle *font = data;
+  guint hash;
+
+  hash = g_str_hash (font->family ? font->family : "");
+  hash = hash * 31 + font->size;
+  hash = hash * 31 + font->weight;
+
+  return hash;
+}
+
+gboolean
+vtile_mapbox_text_style_equal (gconstpointer data_a,
+                               gconstpointer data_b)
+{
+  const VTileMapboxTextStyle *a = data_a;
+  const VTileMapboxTextStyle *b = data_b;
+
+  return !g_strcmp0 (a->family, b->family) &&
+    a->size == b->size &&
+    a->style == b->style &&
+    a->variant == b->variant &&
+    a->weight == b->weight &&
+    a->underline == b->underline;
+}
+
+static guint
+label_key_hash (gconstpointer data)
+{
+  const VTileMapboxLabelKey *key = data;
+  guint hash;
+
+  hash = g_str_hash (key->text);
+  hash = hash * 31 + vtile_mapbox_text_style_hash (&key->font);
+  hash = hash * 31 + key->angle;
+  hash = hash * 31 + g_double_hash (&key->color.r);
+  hash = hash * 31 + g_double_hash (&key->color.g);
+  hash = hash * 31 + g_double_hash (&key->color.b);
+  hash = hash * 31 + key->halo_radius;
+
+  return hash;
+}
+
+static gboolean
+label_color_equal (const VTileMapCSSColor *a,
+                   const VTileMapCSSColor *b)
+{
+  return a->r == b->r && a->g == b->g && a->b == b->b;
+}
+
+static gboolean
+label_key_equal (gconstpointer data_a,
+                 gconstpointer data_b)
+{
+  const VTileMapboxLabelKey *a = data_a;
+  const VTileMapboxLabelKey *b = data_b;
+
+  return g_str_equal (a->text, b->text) &&
+    vtile_mapbox_text_style_equal (&a->font, &b->font) &&
+    a->angle == b->angle &&
+    a->halo_radius == b->halo_radius &&
+    a->mask_halo == b->mask_halo &&
+    label_color_equal (&a->color, &b->color) &&
+    label_color_equal (&a->halo_color, &b->halo_color);
+}
+
+static void
+label_cache_entry_free (LabelCacheEntry *entry)
+{
+  g_free ((char *) entry->key.text);
+  g_free ((char *) entry->key.font.family);
+  cairo_surface_destroy (entry->label.surface);
+  g_free (entry);
+}
+
+/* Drop an entry, called with the cache locked */
+static void
+label_cache_remove (VTileMapboxLabelCache *cache,
+                    LabelCacheEntry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_hash_table_remove (cache->entries, &entry->key);
+  cache->size -= entry->size;
+  label_cache_entry_free (entry);
+}
+
+/**
+ * vtile_mapbox_label_cache_new:
+ * @max_size: the largest number of bytes of label pixels to keep.
+ *
+ * Returns: a new #VTileMapboxLabelCache, use
+ * vtile_mapbox_label_cache_unref() when done.
+ */
+VTileMapboxLabelCache *
+vtile_mapbox_label_cache_new (gsize max_size)
+{
+  VTileMapboxLabelCache *cache;
+
+  cache = g_new0 (VTileMapboxLabelCache, 1);
+  cache->ref_count = 1;
+  cache->max_size = max_size;
+  cache->entries = g_hash_table_new (label_key_hash, label_key_equal);
+  g_queue_init (&cache->lru);
+  g_mutex_init (&cache->lock);
+
+  return cache;
+}
+
+/**
+ * vtile_mapbox_label_cache_get_default:
+ *
+ * Returns: (transfer none): the label cache shared by all render
+ * contexts, holding up to 16 MiB of labels.
+ */
+VTileMapboxLabelCache *
+vtile_mapbox_label_cache_get_default (void)
+{
+  static gsize initialized = 0;
+  static VTileMapboxLabelCache *cache = NULL;
+
+  if (g_once_init_enter (&initialized)) {
+    cache = vtile_mapbox_label_cache_new (DEFAULT_MAX_SIZE);
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return cache;
+}
+
+/**
+ * vtile_mapbox_label_cache_ref:
+ * @cache: a #VTileMapboxLabelCache.
+ *
+ * Returns: @cache
+ */
+VTileMapboxLabelCache *
+vtile_mapbox_label_cache_ref (VTileMapboxLabelCache *cache)
+{
+  g_return_val_if_fail (cache != NULL, NULL);
+
+  g_atomic_int_inc (&cache->ref_count);
+
+  return cache;
+}
+
+/**
+ * vtile_mapbox_label_cache_unref:
+ * @cache: a #VTileMapboxLabelCache.
+ *
+ * Release a reference to @cache, the cache and its labels are freed
+ * when the last reference is gone.
+ */
+void
+vtile_mapbox_label_cache_unref (VTileMapboxLabelCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  if (!g_atomic_int_dec_and_test (&cache->ref_count))
+    return;
+
+  vtile_mapbox_label_cache_clear (cache);
+  g_hash_table_destroy (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+/**
+ * vtile_mapbox_label_cache_clear:
+ * @cache: a #VTileMapboxLabelCache.
+ *
+ * Drop all labels in @cache, for instance after the fonts changed.
+ * Labels handed out before stay valid.
+ */
+void
+vtile_mapbox_label_cache_clear (VTileMapboxLabelCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  g_mutex_lock (&cache->lock);
+  while (cache->lru.head)
+    label_cache_remove (cache, cache->lru.head->data);
+  g_mutex_unlock (&cache->lock);
+}
+
+/**
+ * vtile_mapbox_label_cache_get_size:
+ * @cache: a #VTileMapboxLabelCache.
+ *
+ * Returns: the number of bytes of label pixels in @cache.
+ */
+gsize
+vtile_mapbox_label_cache_get_size (VTileMapboxLabelCache *cache)
+{
+  gsize size;
+
+  g_return_val_if_fail (cache != NULL, 0);
+
+  g_mutex_lock (&cache->lock);
+  size = cache->size;
+  g_mutex_unlock (&cache->lock);
+
+  return size;
+}
+
+/*
+ * Look up a rendered label. On a hit @label is filled in and holds a
+ * new reference to the surface.
+ */
+gboolean
+vtile_mapbox_label_cache_lookup (VTileMapboxLabelCache *cache,
+                                 const VTileMapboxLabelKey *key,
+                                 VTileMapboxLabel *label)
+{
+  LabelCacheEntry *entry;
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (entry) {
+    g_queue_unlink (&cache->lru, &entry->link);
+    g_queue_push_head_link (&cache->lru, &entry->link);
+
+    *label = entry->label;
+    cairo_surface_reference (label->surface);
+  }
+  g_mutex_unlock (&cache->lock);
+
+  return entry != NULL;
+}
+
+/*
+ * Add a rendered label, the cache takes its own reference to the
+ * surface. Labels that were added meanwhile by another thread, or that
+ * would not fit in the cache, are left alone.
+ */
+void
+vtile_mapbox_label_cache_insert (VTileMapboxLabelCache *cache,
+                                 const VTileMapboxLabelKey *key,
+                                 const VTileMapboxLabel *label)
+{
+  LabelCacheEntry *entry;
+  gsize size;
+
+  size = cairo_image_surface_get_stride (label->surface) * label->height;
+  if (size > cache->max_size)
+    return;
+
+  g_mutex_lock (&cache->lock);
+
+  if (g_hash_table_contains (cache->entries, key)) {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+
+  while (cache->size + size > cache->max_size)
+    label_cache_remove (cache, cache->lru.tail->data);
+
+  entry = g_new0 (LabelCacheEntry, 1);
+  entry->key = *key;
+  entry->key.text = g_strdup (key->text);
+  entry->key.font.family = g_strdup (key->font.family);
+  entry->label = *label;
+  entry->label.surface = cairo_surface_reference (label->surface);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_hash_table_insert (cache->entries, &entry->key, entry);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->size += size;
+
+  g_mutex_unlock (&cache->lock);
+}
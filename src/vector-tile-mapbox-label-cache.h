@@ -0,0 +1,45 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_LABEL_CACHE_H__
+#define __VECTOR_TILE_MAPBOX_LABEL_CACHE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VTileMapboxLabelCache:
+ *
+ * A bounded cache of rendered labels, shared between renders and
+ * threads.
+ */
+typedef struct _VTileMapboxLabelCache VTileMapboxLabelCache;
+
+VTileMapboxLabelCache *vtile_mapbox_label_cache_new (gsize max_size);
+VTileMapboxLabelCache *vtile_mapbox_label_cache_get_default (void);
+
+VTileMapboxLabelCache *
+vtile_mapbox_label_cache_ref (VTileMapboxLabelCache *cache);
+void vtile_mapbox_label_cache_unref (VTileMapboxLabelCache *cache);
+
+void vtile_mapbox_label_cache_clear (VTileMapboxLabelCache *cache);
+gsize vtile_mapbox_label_cache_get_size (VTileMapboxLabelCache *cache);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_LABEL_CACHE_H__ */
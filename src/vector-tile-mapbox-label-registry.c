@@ -0,0 +1,242 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "vector-tile-mapbox-label-registry.h"
+#include "vector-tile-mapbox-private.h"
+
+/**
+ * SECTION:vector-tile-mapbox-label-registry
+ * @short_description: Labels shown once across tiles
+ *
+ * A road or a city that spans several tiles has its label placed on
+ * every one of them. A #VTileMapboxLabelRegistry shared by the tiles of
+ * a view, or of a metatile, remembers which tile shows the label of
+ * each feature, by its uid and text, so that the other tiles leave it
+ * out.
+ *
+ * The first tile to place a label claims it. A tile where the label
+ * fits entirely takes the claim over from one where it was cut by the
+ * tile edge; the label is then shown on both until the first tile is
+ * rendered again. Forget a tile with
+ * vtile_mapbox_label_registry_forget_tile() when it leaves the view so
+ * that its labels can be shown elsewhere.
+ *
+ * The registry is only used by renders with
+ * %VTILE_MAPBOX_RENDER_PLACE_LABELS, see
+ * vtile_mapbox_render_context_set_label_registry().
+ */
+
+typedef struct {
+  guint zoom_level;
+  char *uid;
+  char *text;
+
+  guint x;
+  guint y;
+  gboolean inside;
+} LabelRegistryEntry;
+
+struct _VTileMapboxLabelRegistry {
+  volatile gint ref_count;
+
+  GMutex lock;
+  GHashTable *entries;
+};
+
+static guint
+label_registry_entry_hash (gconstpointer data)
+{
+  const LabelRegistryEntry *entry = data;
+
+  return (g_str_hash (entry->uid) * 31 + g_str_hash (entry->text)) * 31 +
+    entry->zoom_level;
+}
+
+static gboolean
+label_registry_entry_equal (gconstpointer data_a,
+                            gconstpointer data_b)
+{
+  const LabelRegistryEntry *a = data_a;
+  const LabelRegistryEntry *b = data_b;
+
+  return a->zoom_level == b->zoom_level &&
+    g_str_equal (a->uid, b->uid) &&
+    g_str_equal (a->text, b->text);
+}
+
+static void
+label_registry_entry_free (LabelRegistryEntry *entry)
+{
+  g_free (entry->uid);
+  g_free (entry->text);
+  g_free (entry);
+}
+
+/**
+ * vtile_mapbox_label_registry_new:
+ *
+ * Returns: a new, empty #VTileMapboxLabelRegistry, use
+ * vtile_mapbox_label_registry_unref() when done.
+ */
+VTileMapboxLabelRegistry *
+vtile_mapbox_label_registry_new (void)
+{
+  VTileMapboxLabelRegistry *registry;
+
+  registry = g_new0 (VTileMapboxLabelRegistry, 1);
+  registry->ref_count = 1;
+  registry->entries =
+    g_hash_table_new_full (label_registry_entry_hash,
+                           label_registry_entry_equal,
+                           (GDestroyNotify) label_registry_entry_free,
+                           NULL);
+  g_mutex_init (&registry->lock);
+
+  return registry;
+}
+
+/**
+ * vtile_mapbox_label_registry_ref:
+ * @registry: a #VTileMapboxLabelRegistry.
+ *
+ * Returns: @registry
+ */
+VTileMapboxLabelRegistry *
+vtile_mapbox_label_registry_ref (VTileMapboxLabelRegistry *registry)
+{
+  g_return_val_if_fail (registry != NULL, NULL);
+
+  g_atomic_int_inc (&registry->ref_count);
+
+  return registry;
+}
+
+/**
+ * vtile_mapbox_label_registry_unref:
+ * @registry: a #VTileMapboxLabelRegistry.
+ *
+ * Release a reference to @registry, it is freed when the last
+ * reference is gone.
+ */
+void
+vtile_mapbox_label_registry_unref (VTileMapboxLabelRegistry *registry)
+{
+  g_return_if_fail (registry != NULL);
+
+  if (!g_atomic_int_dec_and_test (&registry->ref_count))
+    return;
+
+  g_hash_table_destroy (registry->entries);
+  g_mutex_clear (&registry->lock);
+  g_free (registry);
+}
+
+/**
+ * vtile_mapbox_label_registry_forget_tile:
+ * @registry: a #VTileMapboxLabelRegistry.
+ * @zoom_level: the zoom level of the tile.
+ * @x: the x coordinate of the tile.
+ * @y: the y coordinate of the tile.
+ *
+ * Drop the claims of a tile, its labels are placed on the next tile
+ * rendered that has them.
+ */
+void
+vtile_mapbox_label_registry_forget_tile (VTileMapboxLabelRegistry *registry,
+                                         guint zoom_level,
+                                         guint x,
+                                         guint y)
+{
+  GHashTableIter iter;
+  LabelRegistryEntry *entry;
+
+  g_return_if_fail (registry != NULL);
+
+  g_mutex_lock (&registry->lock);
+  g_hash_table_iter_init (&iter, registry->entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL)) {
+    if (entry->zoom_level == zoom_level && entry->x == x && entry->y == y)
+      g_hash_table_iter_remove (&iter);
+  }
+  g_mutex_unlock (&registry->lock);
+}
+
+/**
+ * vtile_mapbox_label_registry_clear:
+ * @registry: a #VTileMapboxLabelRegistry.
+ *
+ * Drop the claims of all tiles.
+ */
+void
+vtile_mapbox_label_registry_clear (VTileMapboxLabelRegistry *registry)
+{
+  g_return_if_fail (registry != NULL);
+
+  g_mutex_lock (&registry->lock);
+  g_hash_table_remove_all (registry->entries);
+  g_mutex_unlock (&registry->lock);
+}
+
+/*
+ * Claim the label @text of the feature @uid for a tile. Returns %TRUE
+ * if the tile should show the label: it was not claimed, the tile
+ * already had it, or it is @inside the tile and was cut off where it
+ * was claimed before.
+ */
+gboolean
+vtile_mapbox_label_registry_claim (VTileMapboxLabelRegistry *registry,
+                                   guint zoom_level,
+                                   guint x,
+                                   guint y,
+                                   const char *uid,
+                                   const char *text,
+                                   gboolean inside)
+{
+  LabelRegistryEntry lookup;
+  LabelRegistryEntry *entry;
+  gboolean claimed = TRUE;
+
+  lookup.zoom_level = zoom_level;
+  lookup.uid = (char *) uid;
+  lookup.text = (char *) text;
+
+  g_mutex_lock (&registry->lock);
+
+  entry = g_hash_table_lookup (registry->entries, &lookup);
+  if (!entry) {
+    entry = g_new (LabelRegistryEntry, 1);
+    entry->zoom_level = zoom_level;
+    entry->uid = g_strdup (uid);
+    entry->text = g_strdup (text);
+    g_hash_table_add (registry->entries, entry);
+  } else if ((entry->x != x || entry->y != y) &&
+             (entry->inside || !inside)) {
+    claimed = FALSE;
+  }
+
+  if (claimed) {
+    entry->x = x;
+    entry->y = y;
+    entry->inside = inside;
+  }
+
+  g_mutex_unlock (&registry->lock);
+
+  return claimed;
+}
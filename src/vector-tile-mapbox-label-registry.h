@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_LABEL_REGISTRY_H__
+#define __VECTOR_TILE_MAPBOX_LABEL_REGISTRY_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VTileMapboxLabelRegistry:
+ *
+ * Keeps track of which tile of a view shows the label of a feature,
+ * shared between renders and threads.
+ */
+typedef struct _VTileMapboxLabelRegistry VTileMapboxLabelRegistry;
+
+VTileMapboxLabelRegistry *vtile_mapbox_label_registry_new (void);
+
+VTileMapboxLabelRegistry *
+vtile_mapbox_label_registry_ref (VTileMapboxLabelRegistry *registry);
+void vtile_mapbox_label_registry_unref (VTileMapboxLabelRegistry *registry);
+
+void vtile_mapbox_label_registry_forget_tile (VTileMapboxLabelRegistry *registry,
+                                              guint zoom_level,
+                                              guint x,
+                                              guint y);
+void vtile_mapbox_label_registry_clear (VTileMapboxLabelRegistry *registry);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_LABEL_REGISTRY_H__ */
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_PRIVATE_H__
+#define __VECTOR_TILE_MAPBOX_PRIVATE_H__
+
+#include <glib.h>
+#include <cairo.h>
+#include <pango/pango.h>
+
+#include "vector-tile-boxed.h"
+#include "vector-tile-mapbox-tile.h"
+#include "vector-tile-mapbox-label-cache.h"
+#include "vector-tile-mapbox-label-registry.h"
+#include "vector-tile-mapbox-render-plan.h"
+#include "vector_tile.pb-c.h"
+
+G_BEGIN_DECLS
+
+struct _VTileMapboxTile {
+  volatile gint ref_count;
+  VectorTile__Tile *tile;
+};
+
+/* The resolved font of a label, the size is in Pango units */
+typedef struct {
+  const char *family;
+  gint size;
+  PangoStyle style;
+  PangoVariant variant;
+  PangoWeight weight;
+  gboolean underline;
+} VTileMapboxTextStyle;
+
+guint vtile_mapbox_text_style_hash (gconstpointer font);
+gboolean vtile_mapbox_text_style_equal (gconstpointer a,
+                                        gconstpointer b);
+
+/*
+ * Everything that decides how a rendered label looks. The angle is
+ * quantised, see MAPBOX_LABEL_ANGLE_STEP in vector-tile-mapbox.c.
+ */
+typedef struct {
+  const char *text;
+  VTileMapboxTextStyle font;
+  VTileMapCSSColor color;
+  VTileMapCSSColor halo_color;
+  gint halo_radius;
+  gint angle;
+  gboolean mask_halo;
+} VTileMapboxLabelKey;
+
+/*
+ * A rendered label. The anchor is the point of the surface that goes
+ * where the label is placed, the layout width is the unrotated width of
+ * the text, used to tell if it fits along a line.
+ */
+typedef struct {
+  cairo_surface_t *surface;
+  gint width;
+  gint height;
+  gint layout_width;
+  gint anchor_x;
+  gint anchor_y;
+} VTileMapboxLabel;
+
+/*
+ * What it takes to draw a label later, shared by the copies of a
+ * VTileMapboxText.
+ */
+typedef struct {
+  volatile gint ref_count;
+
+  VTileMapboxLabelKey key;
+  VTileMapboxLabel label;
+  cairo_matrix_t matrix;
+  VTileMapboxLabelCache *cache;
+} VTileMapboxLazyLabel;
+
+VTileMapboxLazyLabel *vtile_mapbox_lazy_label_ref (VTileMapboxLazyLabel *lazy);
+void vtile_mapbox_lazy_label_unref (VTileMapboxLazyLabel *lazy);
+
+gboolean vtile_mapbox_label_cache_lookup (VTileMapboxLabelCache *cache,
+                                          const VTileMapboxLabelKey *key,
+                                          VTileMapboxLabel *label);
+void vtile_mapbox_label_cache_insert (VTileMapboxLabelCache *cache,
+                                      const VTileMapboxLabelKey *key,
+                                      const VTileMapboxLabel *label);
+
+gboolean vtile_mapbox_label_registry_claim (VTileMapboxLabelRegistry *registry,
+                                            guint zoom_level,
+                                            guint x,
+                                            guint y,
+                                            const char *uid,
+                                            const char *text,
+                                            gboolean inside);
+
+/*
+ * The resolved cairo state a feature, or its casing, is drawn with. A
+ * line cap or join of -1 keeps the one of the cairo context, as does a
+ * dash that is not set. Polygons are filled after they are stroked,
+ * drafts fill them without stroking.
+ */
+typedef struct {
+  gboolean stroke;
+  VTileMapCSSColor color;
+  gdouble opacity;
+  gdouble width;
+  gint line_cap;
+  gint line_join;
+  gboolean has_dash;
+  VTileMapCSSDash dash;
+
+  gboolean fill;
+  VTileMapCSSColor fill_color;
+  gdouble fill_opacity;
+} VTileMapboxDrawParams;
+
+void vtile_mapbox_draw_params_paint (const VTileMapboxDrawParams *params,
+                                     cairo_t *cr,
+                                     gboolean fast_fills);
+
+VTileMapboxRenderPlan *vtile_mapbox_render_plan_new (guint tile_size);
+void vtile_mapbox_render_plan_add (VTileMapboxRenderPlan *plan,
+                                   const VTileMapboxDrawParams *params,
+                                   const cairo_path_t *path);
+void vtile_mapbox_render_plan_seal (VTileMapboxRenderPlan *plan,
+                                    GList *texts,
+                                    GList *atlases);
+
+void vtile_mapbox_set_parallel_limits (guint min_features,
+                                       guint chunk_size);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_PRIVATE_H__ */
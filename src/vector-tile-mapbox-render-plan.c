@@ -0,0 +1,793 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <cairo.h>
+#include <string.h>
+
+#include "vector-tile-mapbox.h"
+#include "vector-tile-mapbox-render-plan.h"
+#include "vector-tile-mapbox-private.h"
+#include "vector-tile-scanline.h"
+
+/**
+ * SECTION:vector-tile-mapbox-render-plan
+ * @short_description: A tile resolved once and drawn many times
+ *
+ * Rendering a tile mostly goes to extracting the tags of its features,
+ * matching them against the stylesheet, sorting them and decoding their
+ * geometry. A #VTileMapboxRenderPlan, built with
+ * vtile_mapbox_render_context_build_plan(), keeps the outcome: the
+ * features to draw in order, with their geometry in tile pixels and the
+ * line and fill state they are drawn with, and the labels of the tile.
+ *
+ * Drawing a plan with vtile_mapbox_render_plan_render() only
+ * rasterises, so a tile that is repainted or drawn to a new surface
+ * does not need to be rendered again. A plan never changes once built
+ * and can be drawn from several threads at once.
+ *
+ * A plan can be turned into bytes with
+ * vtile_mapbox_render_plan_serialize(), to be kept on disk or sent to a
+ * client, and read back with vtile_mapbox_render_plan_new_from_bytes().
+ * The labels of a plan read back are drawn when they are asked for,
+ * see vtile_mapbox_text_get_surface().
+ */
+
+/*
+ * The serialized form of a plan, all numbers are little endian 32 bit
+ * integers or 64 bit doubles:
+ *
+ *   "VTRP", version, tile size, number of items, number of texts
+ *   per item: draw params, number of path data, the path data
+ *   per text: the text fields, the label key, the label and matrix
+ *
+ * Strings are a length followed by the bytes, without a nul, with a
+ * length of 0xffffffff for NULL. Bump the version with every change.
+ */
+#define RENDER_PLAN_MAGIC "VTRP"
+#define RENDER_PLAN_VERSION 2
+#define RENDER_PLAN_NULL_STRING 0xffffffff
+
+/* A feature, or the casing of one, and where its path starts */
+typedef struct {
+  VTileMapboxDrawParams params;
+  guint path_start;
+  guint path_length;
+} RenderPlanItem;
+
+struct _VTileMapboxRenderPlan {
+  volatile gint ref_count;
+
+  guint tile_size;
+  RenderPlanItem *items;
+  guint n_items;
+  cairo_path_data_t *path_data;
+  guint n_path_data;
+
+  /* Only used while the plan is built */
+  GArray *item_array;
+  GArray *path_array;
+
+  GList *texts;
+  GList *atlases;
+};
+
+/*
+ * With @fast_fills, have the scanline filler do what it can of an
+ * opaque fill of the current path of @cr. Returns TRUE if it is all
+ * done, the path used up. Otherwise the path is left for cairo, and
+ * @cr may be clipped to the pixels still to fill, so call this between
+ * cairo_save() and cairo_restore().
+ */
+static gboolean
+draw_params_fast_fill (const VTileMapboxDrawParams *params,
+                       cairo_t *cr,
+                       gboolean fast_fills)
+{
+  return fast_fills && params->fill_opacity >= 1.0 &&
+    vtile_scanline_fill (cr,
+                         params->fill_color.r,
+                         params->fill_color.g,
+                         params->fill_color.b) == VTILE_SCANLINE_FILLED;
+}
+
+/*
+ * Stroke, and fill if it is a polygon, the current path of @cr with
+ * @params. The path is used up.
+ */
+void
+vtile_mapbox_draw_params_paint (const VTileMapboxDrawParams *params,
+                                cairo_t *cr,
+                                gboolean fast_fills)
+{
+  if (!params->stroke) {
+    cairo_save (cr);
+    if (!draw_params_fast_fill (params, cr, fast_fills)) {
+      cairo_set_source_rgba (cr,
+                             params->fill_color.r,
+                             params->fill_color.g,
+                             params->fill_color.b,
+                             params->fill_opacity);
+      cairo_fill (cr);
+    }
+    cairo_restore (cr);
+    return;
+  }
+
+  cairo_set_source_rgba (cr,
+                         params->color.r,
+                         params->color.g,
+                         params->color.b,
+                         params->opacity);
+  cairo_set_line_width (cr, params->width);
+  if (params->line_cap >= 0)
+    cairo_set_line_cap (cr, params->line_cap);
+  if (params->line_join >= 0)
+    cairo_set_line_join (cr, params->line_join);
+  if (params->has_dash)
+    cairo_set_dash (cr, params->dash.dashes, params->dash.num_dashes, 0);
+
+  if (params->fill) {
+    cairo_stroke_preserve (cr);
+
+    cairo_save (cr);
+    if (!draw_params_fast_fill (params, cr, fast_fills)) {
+      cairo_clip (cr);
+      cairo_set_source_rgba (cr,
+                             params->fill_color.r,
+                             params->fill_color.g,
+                             params->fill_color.b,
+                             params->fill_opacity);
+      cairo_paint (cr);
+    }
+    cairo_restore (cr);
+  } else {
+    cairo_stroke (cr);
+  }
+}
+
+/* Start an empty plan, filled in while a render context builds it */
+VTileMapboxRenderPlan *
+vtile_mapbox_render_plan_new (guint tile_size)
+{
+  VTileMapboxRenderPlan *plan;
+
+  plan = g_new0 (VTileMapboxRenderPlan, 1);
+  plan->ref_count = 1;
+  plan->tile_size = tile_size;
+  plan->item_array = g_array_new (FALSE, FALSE, sizeof (RenderPlanItem));
+  plan->path_array = g_array_new (FALSE, FALSE, sizeof (cairo_path_data_t));
+
+  return plan;
+}
+
+/* Add a path to draw with @params, on top of what was added before */
+void
+vtile_mapbox_render_plan_add (VTileMapboxRenderPlan *plan,
+                              const VTileMapboxDrawParams *params,
+                              const cairo_path_t *path)
+{
+  RenderPlanItem item;
+
+  item.params = *params;
+  item.path_start = plan->path_array->len;
+  item.path_length = path->num_data;
+
+  g_array_append_vals (plan->path_array, path->data, path->num_data);
+  g_array_append_val (plan->item_array, item);
+}
+
+/*
+ * Finish building a plan, it takes the texts and atlases of the render.
+ * The items and paths are kept in arrays of exactly their size.
+ */
+void
+vtile_mapbox_render_plan_seal (VTileMapboxRenderPlan *plan,
+                               GList *texts,
+                               GList *atlases)
+{
+  plan->n_items = plan->item_array->len;
+  plan->items = (RenderPlanItem *) g_array_free (plan->item_array, FALSE);
+  plan->items = g_renew (RenderPlanItem, plan->items, plan->n_items);
+  plan->item_array = NULL;
+
+  plan->n_path_data = plan->path_array->len;
+  plan->path_data = (cairo_path_data_t *) g_array_free (plan->path_array,
+                                                        FALSE);
+  plan->path_data = g_renew (cairo_path_data_t, plan->path_data,
+                             plan->n_path_data);
+  plan->path_array = NULL;
+
+  plan->texts = texts;
+  plan->atlases = atlases;
+}
+
+/**
+ * vtile_mapbox_render_plan_ref:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Returns: @plan
+ */
+VTileMapboxRenderPlan *
+vtile_mapbox_render_plan_ref (VTileMapboxRenderPlan *plan)
+{
+  g_return_val_if_fail (plan != NULL, NULL);
+
+  g_atomic_int_inc (&plan->ref_count);
+
+  return plan;
+}
+
+/**
+ * vtile_mapbox_render_plan_unref:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Release a reference to @plan, it is freed when the last reference is
+ * gone.
+ */
+void
+vtile_mapbox_render_plan_unref (VTileMapboxRenderPlan *plan)
+{
+  g_return_if_fail (plan != NULL);
+
+  if (!g_atomic_int_dec_and_test (&plan->ref_count))
+    return;
+
+  if (plan->item_array)
+    g_array_free (plan->item_array, TRUE);
+  if (plan->path_array)
+    g_array_free (plan->path_array, TRUE);
+  g_free (plan->items);
+  g_free (plan->path_data);
+  g_list_free_full (plan->texts, (GDestroyNotify) vtile_mapbox_text_free);
+  g_list_free_full (plan->atlases, (GDestroyNotify) cairo_surface_destroy);
+  g_free (plan);
+}
+
+/**
+ * vtile_mapbox_render_plan_get_tile_size:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Returns: the size (width/height) of the tile @plan draws.
+ */
+guint
+vtile_mapbox_render_plan_get_tile_size (VTileMapboxRenderPlan *plan)
+{
+  g_return_val_if_fail (plan != NULL, 0);
+
+  return plan->tile_size;
+}
+
+/**
+ * vtile_mapbox_render_plan_get_n_items:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Returns: the number of paths @plan strokes or fills, casings
+ * included.
+ */
+guint
+vtile_mapbox_render_plan_get_n_items (VTileMapboxRenderPlan *plan)
+{
+  g_return_val_if_fail (plan != NULL, 0);
+
+  return plan->n_items;
+}
+
+/**
+ * vtile_mapbox_render_plan_render:
+ * @plan: a #VTileMapboxRenderPlan.
+ * @cr: the cairo context to render to.
+ *
+ * Draw the tile of @plan to @cr. On a target with the identity
+ * transformation the output is the same as that of the render that
+ * built @plan; any other transformation of @cr, such as a scale, is
+ * applied to the whole tile.
+ */
+void
+vtile_mapbox_render_plan_render (VTileMapboxRenderPlan *plan,
+                                 cairo_t *cr)
+{
+  guint i;
+
+  g_return_if_fail (plan != NULL);
+  g_return_if_fail (plan->item_array == NULL);
+  g_return_if_fail (cr != NULL);
+
+  for (i = 0; i < plan->n_items; i++) {
+    const RenderPlanItem *item = &plan->items[i];
+    cairo_path_t path;
+
+    path.status = CAIRO_STATUS_SUCCESS;
+    path.data = plan->path_data + item->path_start;
+    path.num_data = item->path_length;
+
+    cairo_new_path (cr);
+    cairo_append_path (cr, &path);
+    vtile_mapbox_draw_params_paint (&item->params, cr, FALSE);
+  }
+}
+
+static void
+plan_write_uint (GByteArray *out,
+                 guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+plan_write_double (GByteArray *out,
+                   gdouble value)
+{
+  guint64 bits;
+
+  memcpy (&bits, &value, sizeof (bits));
+  bits = GUINT64_TO_LE (bits);
+  g_byte_array_append (out, (const guint8 *) &bits, sizeof (bits));
+}
+
+static void
+plan_write_string (GByteArray *out,
+                   const char *value)
+{
+  if (!value) {
+    plan_write_uint (out, RENDER_PLAN_NULL_STRING);
+    return;
+  }
+
+  plan_write_uint (out, strlen (value));
+  g_byte_array_append (out, (const guint8 *) value, strlen (value));
+}
+
+static void
+plan_write_color (GByteArray *out,
+                  const VTileMapCSSColor *color)
+{
+  plan_write_double (out, color->r);
+  plan_write_double (out, color->g);
+  plan_write_double (out, color->b);
+}
+
+static void
+plan_write_params (GByteArray *out,
+                   const VTileMapboxDrawParams *params)
+{
+  guint i;
+
+  plan_write_uint (out, params->stroke);
+  plan_write_color (out, &params->color);
+  plan_write_double (out, params->opacity);
+  plan_write_double (out, params->width);
+  plan_write_uint (out, params->line_cap);
+  plan_write_uint (out, params->line_join);
+  plan_write_uint (out, params->has_dash);
+  plan_write_uint (out, params->dash.num_dashes);
+  for (i = 0; i < G_N_ELEMENTS (params->dash.dashes); i++)
+    plan_write_double (out, params->dash.dashes[i]);
+  plan_write_uint (out, params->fill);
+  plan_write_color (out, &params->fill_color);
+  plan_write_double (out, params->fill_opacity);
+}
+
+static void
+plan_write_path (GByteArray *out,
+                 const cairo_path_data_t *data,
+                 guint n_data)
+{
+  guint i, j;
+
+  plan_write_uint (out, n_data);
+  for (i = 0; i < n_data; i += data[i].header.length) {
+    plan_write_uint (out, data[i].header.type);
+    plan_write_uint (out, data[i].header.length);
+    for (j = 1; j < data[i].header.length; j++) {
+      plan_write_double (out, data[i + j].point.x);
+      plan_write_double (out, data[i + j].point.y);
+    }
+  }
+}
+
+static void
+plan_write_text (GByteArray *out,
+                 const VTileMapboxText *text)
+{
+  const VTileMapboxLazyLabel *lazy = text->lazy;
+  const VTileMapboxLabelKey *key = &lazy->key;
+  const cairo_matrix_t *matrix = &lazy->matrix;
+
+  plan_write_uint (out, text->offset_x);
+  plan_write_uint (out, text->offset_y);
+  plan_write_uint (out, text->width);
+  plan_write_uint (out, text->height);
+  plan_write_double (out, text->angle);
+  plan_write_string (out, text->text);
+  plan_write_string (out, text->uid);
+
+  plan_write_string (out, key->font.family);
+  plan_write_uint (out, key->font.size);
+  plan_write_uint (out, key->font.style);
+  plan_write_uint (out, key->font.variant);
+  plan_write_uint (out, key->font.weight);
+  plan_write_uint (out, key->font.underline);
+  plan_write_color (out, &key->color);
+  plan_write_color (out, &key->halo_color);
+  plan_write_uint (out, key->halo_radius);
+  plan_write_uint (out, key->angle);
+  plan_write_uint (out, key->mask_halo);
+
+  plan_write_uint (out, lazy->label.width);
+  plan_write_uint (out, lazy->label.height);
+  plan_write_uint (out, lazy->label.layout_width);
+  plan_write_uint (out, lazy->label.anchor_x);
+  plan_write_uint (out, lazy->label.anchor_y);
+  plan_write_double (out, matrix->xx);
+  plan_write_double (out, matrix->yx);
+  plan_write_double (out, matrix->xy);
+  plan_write_double (out, matrix->yy);
+  plan_write_double (out, matrix->x0);
+  plan_write_double (out, matrix->y0);
+}
+
+/**
+ * vtile_mapbox_render_plan_serialize:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Write @plan, with its labels but not their surfaces, to a compact
+ * versioned binary form. The same plan always gives the same bytes.
+ *
+ * Returns: (transfer full): the serialized @plan.
+ */
+GBytes *
+vtile_mapbox_render_plan_serialize (VTileMapboxRenderPlan *plan)
+{
+  GByteArray *out;
+  GList *l;
+  guint i;
+
+  g_return_val_if_fail (plan != NULL, NULL);
+  g_return_val_if_fail (plan->item_array == NULL, NULL);
+
+  out = g_byte_array_new ();
+  g_byte_array_append (out, (const guint8 *) RENDER_PLAN_MAGIC, 4);
+  plan_write_uint (out, RENDER_PLAN_VERSION);
+  plan_write_uint (out, plan->tile_size);
+  plan_write_uint (out, plan->n_items);
+  plan_write_uint (out, g_list_length (plan->texts));
+
+  for (i = 0; i < plan->n_items; i++) {
+    const RenderPlanItem *item = &plan->items[i];
+
+    plan_write_params (out, &item->params);
+    plan_write_path (out, plan->path_data + item->path_start,
+                     item->path_length);
+  }
+
+  for (l = plan->texts; l; l = l->next)
+    plan_write_text (out, l->data);
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+/* Reads stop at the end of the data, which marks the reader failed */
+typedef struct {
+  const guint8 *data;
+  gsize size;
+  gsize pos;
+  gboolean failed;
+} RenderPlanReader;
+
+static gboolean
+plan_read_bytes (RenderPlanReader *reader,
+                 gpointer dest,
+                 gsize size)
+{
+  if (reader->failed || reader->size - reader->pos < size) {
+    reader->failed = TRUE;
+    return FALSE;
+  }
+
+  memcpy (dest, reader->data + reader->pos, size);
+  reader->pos += size;
+
+  return TRUE;
+}
+
+static guint32
+plan_read_uint (RenderPlanReader *reader)
+{
+  guint32 value = 0;
+
+  plan_read_bytes (reader, &value, sizeof (value));
+
+  return GUINT32_FROM_LE (value);
+}
+
+static gint32
+plan_read_int (RenderPlanReader *reader)
+{
+  return (gint32) plan_read_uint (reader);
+}
+
+static gdouble
+plan_read_double (RenderPlanReader *reader)
+{
+  guint64 bits = 0;
+  gdouble value;
+
+  plan_read_bytes (reader, &bits, sizeof (bits));
+  bits = GUINT64_FROM_LE (bits);
+  memcpy (&value, &bits, sizeof (value));
+
+  return value;
+}
+
+static char *
+plan_read_string (RenderPlanReader *reader)
+{
+  guint32 length = plan_read_uint (reader);
+  char *value;
+
+  if (reader->failed || length == RENDER_PLAN_NULL_STRING)
+    return NULL;
+
+  if (reader->size - reader->pos < length) {
+    reader->failed = TRUE;
+    return NULL;
+  }
+
+  value = g_strndup ((const char *) reader->data + reader->pos, length);
+  reader->pos += length;
+
+  return value;
+}
+
+static void
+plan_read_color (RenderPlanReader *reader,
+                 VTileMapCSSColor *color)
+{
+  color->r = plan_read_double (reader);
+  color->g = plan_read_double (reader);
+  color->b = plan_read_double (reader);
+}
+
+static void
+plan_read_params (RenderPlanReader *reader,
+                  VTileMapboxDrawParams *params)
+{
+  guint i;
+
+  params->stroke = plan_read_uint (reader);
+  plan_read_color (reader, &params->color);
+  params->opacity = plan_read_double (reader);
+  params->width = plan_read_double (reader);
+  params->line_cap = plan_read_int (reader);
+  params->line_join = plan_read_int (reader);
+  params->has_dash = plan_read_uint (reader);
+  params->dash.num_dashes = plan_read_int (reader);
+  for (i = 0; i < G_N_ELEMENTS (params->dash.dashes); i++)
+    params->dash.dashes[i] = plan_read_double (reader);
+  params->fill = plan_read_uint (reader);
+  plan_read_color (reader, &params->fill_color);
+  params->fill_opacity = plan_read_double (reader);
+
+  if (params->dash.num_dashes < 0 ||
+      params->dash.num_dashes > (gint) G_N_ELEMENTS (params->dash.dashes))
+    reader->failed = TRUE;
+}
+
+/* The number of path data each type of path element takes */
+static guint
+plan_path_length (cairo_path_data_type_t type)
+{
+  switch (type) {
+  case CAIRO_PATH_MOVE_TO:
+  case CAIRO_PATH_LINE_TO:
+    return 2;
+  case CAIRO_PATH_CURVE_TO:
+    return 4;
+  case CAIRO_PATH_CLOSE_PATH:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void
+plan_read_path (RenderPlanReader *reader,
+                GArray *path_array)
+{
+  guint n_data = plan_read_uint (reader);
+  guint i, j;
+
+  for (i = 0; i < n_data && !reader->failed; ) {
+    cairo_path_data_t data;
+
+    data.header.type = plan_read_uint (reader);
+    data.header.length = plan_read_uint (reader);
+    if (data.header.length != plan_path_length (data.header.type) ||
+        data.header.length > n_data - i) {
+      reader->failed = TRUE;
+      return;
+    }
+    g_array_append_val (path_array, data);
+
+    for (j = 1; j < data.header.length; j++) {
+      data.point.x = plan_read_double (reader);
+      data.point.y = plan_read_double (reader);
+      g_array_append_val (path_array, data);
+    }
+
+    i += data.header.length;
+  }
+}
+
+static VTileMapboxText *
+plan_read_text (RenderPlanReader *reader)
+{
+  VTileMapboxLazyLabel *lazy;
+  VTileMapboxText *text;
+  cairo_matrix_t *matrix;
+
+  text = g_new0 (VTileMapboxText, 1);
+  text->offset_x = plan_read_int (reader);
+  text->offset_y = plan_read_int (reader);
+  text->width = plan_read_int (reader);
+  text->height = plan_read_int (reader);
+  text->angle = plan_read_double (reader);
+  text->text = plan_read_string (reader);
+  text->uid = plan_read_string (reader);
+
+  lazy = g_new0 (VTileMapboxLazyLabel, 1);
+  lazy->ref_count = 1;
+  lazy->cache =
+    vtile_mapbox_label_cache_ref (vtile_mapbox_label_cache_get_default ());
+  lazy->key.text = g_strdup (text->text);
+  lazy->key.font.family = plan_read_string (reader);
+  lazy->key.font.size = plan_read_int (reader);
+  lazy->key.font.style = plan_read_int (reader);
+  lazy->key.font.variant = plan_read_int (reader);
+  lazy->key.font.weight = plan_read_int (reader);
+  lazy->key.font.underline = plan_read_uint (reader);
+  plan_read_color (reader, &lazy->key.color);
+  plan_read_color (reader, &lazy->key.halo_color);
+  lazy->key.halo_radius = plan_read_int (reader);
+  lazy->key.angle = plan_read_int (reader);
+  lazy->key.mask_halo = plan_read_uint (reader);
+
+  lazy->label.width = plan_read_int (reader);
+  lazy->label.height = plan_read_int (reader);
+  lazy->label.layout_width = plan_read_int (reader);
+  lazy->label.anchor_x = plan_read_int (reader);
+  lazy->label.anchor_y = plan_read_int (reader);
+  matrix = &lazy->matrix;
+  matrix->xx = plan_read_double (reader);
+  matrix->yx = plan_read_double (reader);
+  matrix->xy = plan_read_double (reader);
+  matrix->yy = plan_read_double (reader);
+  matrix->x0 = plan_read_double (reader);
+  matrix->y0 = plan_read_double (reader);
+  text->lazy = lazy;
+
+  /* A label is drawn from its text, it must have one */
+  if (!text->text || lazy->label.width < 0 || lazy->label.height < 0)
+    reader->failed = TRUE;
+
+  return text;
+}
+
+/**
+ * vtile_mapbox_render_plan_new_from_bytes:
+ * @bytes: a plan written by vtile_mapbox_render_plan_serialize().
+ * @error: a #GError, or %NULL.
+ *
+ * Read back a serialized plan. Its labels have no surfaces yet, they
+ * are drawn with the default label cache when they are asked for.
+ *
+ * Returns: (transfer full): a new #VTileMapboxRenderPlan, or %NULL
+ * with %VTILE_MAPBOX_ERROR_INVALID_PLAN if @bytes is not a plan this
+ * version of the library reads.
+ */
+VTileMapboxRenderPlan *
+vtile_mapbox_render_plan_new_from_bytes (GBytes *bytes,
+                                         GError **error)
+{
+  VTileMapboxRenderPlan *plan;
+  RenderPlanReader reader = { NULL, 0, 0, FALSE };
+  GList *texts = NULL;
+  char magic[4];
+  guint32 version, n_items, n_texts;
+  guint i;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  reader.data = g_bytes_get_data (bytes, &reader.size);
+
+  plan_read_bytes (&reader, magic, sizeof (magic));
+  version = plan_read_uint (&reader);
+  if (reader.failed || memcmp (magic, RENDER_PLAN_MAGIC, 4) != 0) {
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_INVALID_PLAN,
+                 "The data is not a render plan");
+    return NULL;
+  }
+
+  if (version != RENDER_PLAN_VERSION) {
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_INVALID_PLAN,
+                 "Render plans of version %u are not supported", version);
+    return NULL;
+  }
+
+  plan = vtile_mapbox_render_plan_new (plan_read_uint (&reader));
+  n_items = plan_read_uint (&reader);
+  n_texts = plan_read_uint (&reader);
+
+  for (i = 0; i < n_items && !reader.failed; i++) {
+    RenderPlanItem item;
+
+    plan_read_params (&reader, &item.params);
+    item.path_start = plan->path_array->len;
+    plan_read_path (&reader, plan->path_array);
+    item.path_length = plan->path_array->len - item.path_start;
+    g_array_append_val (plan->item_array, item);
+  }
+
+  for (i = 0; i < n_texts && !reader.failed; i++)
+    texts = g_list_prepend (texts, plan_read_text (&reader));
+  texts = g_list_reverse (texts);
+
+  vtile_mapbox_render_plan_seal (plan, texts, NULL);
+
+  if (reader.failed || reader.pos != reader.size) {
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_INVALID_PLAN,
+                 "The render plan is damaged");
+    vtile_mapbox_render_plan_unref (plan);
+    return NULL;
+  }
+
+  return plan;
+}
+
+/**
+ * vtile_mapbox_render_plan_get_texts:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Returns: (element-type VTileMapboxText) (transfer none): the labels
+ * of the tile, as vtile_mapbox_render_context_get_texts() returns them
+ * after a render.
+ */
+GList *
+vtile_mapbox_render_plan_get_texts (VTileMapboxRenderPlan *plan)
+{
+  g_return_val_if_fail (plan != NULL, NULL);
+
+  return plan->texts;
+}
+
+/**
+ * vtile_mapbox_render_plan_get_label_atlases:
+ * @plan: a #VTileMapboxRenderPlan.
+ *
+ * Returns: (element-type cairo_surface_t) (transfer none): the atlas
+ * surfaces of the labels, see
+ * vtile_mapbox_render_context_get_label_atlases().
+ */
+GList *
+vtile_mapbox_render_plan_get_label_atlases (VTileMapboxRenderPlan *plan)
+{
+  g_return_val_if_fail (plan != NULL, NULL);
+
+  return plan->atlases;
+}
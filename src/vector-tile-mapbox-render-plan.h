@@ -0,0 +1,55 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_RENDER_PLAN_H__
+#define __VECTOR_TILE_MAPBOX_RENDER_PLAN_H__
+
+#include <glib-object.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VTileMapboxRenderPlan:
+ *
+ * The resolved and decoded drawing of a tile, ready to be drawn to any
+ * number of cairo contexts.
+ */
+typedef struct _VTileMapboxRenderPlan VTileMapboxRenderPlan;
+
+VTileMapboxRenderPlan *
+vtile_mapbox_render_plan_ref (VTileMapboxRenderPlan *plan);
+void vtile_mapbox_render_plan_unref (VTileMapboxRenderPlan *plan);
+
+guint vtile_mapbox_render_plan_get_tile_size (VTileMapboxRenderPlan *plan);
+guint vtile_mapbox_render_plan_get_n_items (VTileMapboxRenderPlan *plan);
+
+void vtile_mapbox_render_plan_render (VTileMapboxRenderPlan *plan,
+                                      cairo_t *cr);
+
+GBytes *vtile_mapbox_render_plan_serialize (VTileMapboxRenderPlan *plan);
+VTileMapboxRenderPlan *
+vtile_mapbox_render_plan_new_from_bytes (GBytes *bytes,
+                                         GError **error);
+
+GList *vtile_mapbox_render_plan_get_texts (VTileMapboxRenderPlan *plan);
+GList *
+vtile_mapbox_render_plan_get_label_atlases (VTileMapboxRenderPlan *plan);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_RENDER_PLAN_H__ */
@@ -0,0 +1,812 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "vector-tile-mapbox.h"
+#include "vector-tile-mapbox-scheduler.h"
+
+/**
+ * SECTION:vector-tile-mapbox-scheduler
+ * @short_description: Render tiles on a set of worker threads
+ *
+ * A #VTileMapboxScheduler renders #VTileMapboxRenderContext objects on
+ * its own worker threads, each into a new image surface.
+ *
+ * Requests are run visible first, then by priority, lowest value first
+ * like for GLib sources, then in the order they were queued. Every
+ * worker has its own queue and picks work from the other queues when
+ * they hold more urgent requests than its own, or when its own queue
+ * is empty.
+ *
+ * Cancelling the #GCancellable of a request stops its render, also
+ * when it is already running. Requests that have not started yet are
+ * cheap to drop, either by cancelling their #GCancellable or with
+ * vtile_mapbox_scheduler_drop_queued(), for instance when the user pans
+ * the map and the queued tiles go out of view. When more than
+ * #VTileMapboxScheduler:max-queued requests are waiting, the least
+ * urgent one fails with %VTILE_MAPBOX_ERROR_QUEUE_FULL.
+ */
+
+typedef struct _SchedulerState SchedulerState;
+
+typedef struct {
+  GTask *task;
+  VTileMapboxRenderContext *ctx;
+  gint priority;
+  gboolean visible;
+  guint64 seq;
+
+  GSequence *queue;
+  GSequenceIter *iter;
+} SchedulerRequest;
+
+typedef struct {
+  SchedulerState *state;
+  GThread *thread;
+  GSequence *queue;
+} SchedulerWorker;
+
+/*
+ * The state shared with the worker threads. It is refcounted since the
+ * last reference to the scheduler can be dropped from a worker thread,
+ * when a render callback releases it.
+ */
+struct _SchedulerState {
+  volatile gint ref_count;
+
+  GMutex lock;
+  GCond cond;
+  gboolean quit;
+
+  guint n_workers;
+  guint max_queued;
+  SchedulerWorker *workers;
+
+  /* The contexts of queued and running requests */
+  GHashTable *requests;
+  guint n_queued;
+  guint64 seq;
+};
+
+struct _VTileMapboxSchedulerPrivate {
+  guint n_workers;
+  guint max_queued;
+
+  SchedulerState *state;
+};
+
+enum {
+  PROP_0,
+
+  PROP_N_WORKERS,
+  PROP_MAX_QUEUED
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (VTileMapboxScheduler, vtile_mapbox_scheduler,
+                            G_TYPE_OBJECT)
+
+static void
+scheduler_request_free (SchedulerRequest *request)
+{
+  vtile_mapbox_render_context_unref (request->ctx);
+  g_object_unref (request->task);
+  g_free (request);
+}
+
+/* Visible requests first, then by priority */
+static gint
+scheduler_request_compare_urgency (const SchedulerRequest *a,
+                                   const SchedulerRequest *b)
+{
+  if (a->visible != b->visible)
+    return a->visible ? -1 : 1;
+
+  if (a->priority < b->priority)
+    return -1;
+  else if (a->priority > b->priority)
+    return 1;
+
+  return 0;
+}
+
+static gint
+scheduler_request_compare (gconstpointer a,
+                           gconstpointer b,
+                           gpointer user_data)
+{
+  const SchedulerRequest *request_a = a;
+  const SchedulerRequest *request_b = b;
+  gint urgency;
+
+  urgency = scheduler_request_compare_urgency (request_a, request_b);
+  if (urgency)
+    return urgency;
+
+  if (request_a->seq < request_b->seq)
+    return -1;
+  else if (request_a->seq > request_b->seq)
+    return 1;
+
+  return 0;
+}
+
+static SchedulerState *
+scheduler_state_ref (SchedulerState *state)
+{
+  g_atomic_int_inc (&state->ref_count);
+
+  return state;
+}
+
+static void
+scheduler_state_unref (SchedulerState *state)
+{
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&state->ref_count))
+    return;
+
+  for (i = 0; i < state->n_workers; i++)
+    g_sequence_free (state->workers[i].queue);
+
+  g_free (state->workers);
+  g_hash_table_destroy (state->requests);
+  g_mutex_clear (&state->lock);
+  g_cond_clear (&state->cond);
+  g_free (state);
+}
+
+/*
+ * Take a request out of its queue, called with the state locked. Its
+ * context stays known until the request is finished.
+ */
+static void
+scheduler_unqueue_request (SchedulerState *state,
+                           SchedulerRequest *request)
+{
+  g_sequence_remove (request->iter);
+  request->iter = NULL;
+  request->queue = NULL;
+  state->n_queued--;
+}
+
+/* Drop a request that will not run, called with the state locked */
+static void
+scheduler_remove_request (SchedulerState *state,
+                          SchedulerRequest *request)
+{
+  scheduler_unqueue_request (state, request);
+  g_hash_table_remove (state->requests, request->ctx);
+}
+
+/*
+ * Returns the request @worker should run next: the head of its own
+ * queue, unless another queue has a more urgent head. Called with the
+ * state locked and at least one request queued.
+ */
+static SchedulerRequest *
+scheduler_take_request (SchedulerState *state,
+                        SchedulerWorker *worker)
+{
+  SchedulerRequest *best = NULL;
+  guint i;
+
+  if (!g_sequence_is_empty (worker->queue))
+    best = g_sequence_get (g_sequence_get_begin_iter (worker->queue));
+
+  for (i = 0; i < state->n_workers; i++) {
+    SchedulerWorker *other = &state->workers[i];
+    SchedulerRequest *head;
+
+    if (other == worker || g_sequence_is_empty (other->queue))
+      continue;
+
+    head = g_sequence_get (g_sequence_get_begin_iter (other->queue));
+    if (!best || scheduler_request_compare_urgency (head, best) < 0)
+      best = head;
+  }
+
+  scheduler_unqueue_request (state, best);
+
+  return best;
+}
+
+/* Returns the least urgent queued request, called with the state locked */
+static SchedulerRequest *
+scheduler_find_least_urgent (SchedulerState *state)
+{
+  SchedulerRequest *worst = NULL;
+  guint i;
+
+  for (i = 0; i < state->n_workers; i++) {
+    GSequence *queue = state->workers[i].queue;
+    SchedulerRequest *tail;
+
+    if (g_sequence_is_empty (queue))
+      continue;
+
+    tail = g_sequence_get (g_sequence_iter_prev (g_sequence_get_end_iter (queue)));
+    if (!worst || scheduler_request_compare (tail, worst, NULL) > 0)
+      worst = tail;
+  }
+
+  return worst;
+}
+
+/*
+ * Remove queued requests whose cancellable has been triggered. With
+ * @all set every other queued request is removed too, except visible
+ * ones if @keep_visible is set. Called with the state locked, returns
+ * the removed requests to be completed once it is unlocked.
+ */
+static GList *
+scheduler_remove_requests (SchedulerState *state,
+                           gboolean all,
+                           gboolean keep_visible)
+{
+  GList *removed = NULL;
+  guint i;
+
+  for (i = 0; i < state->n_workers; i++) {
+    GSequenceIter *iter;
+
+    iter = g_sequence_get_begin_iter (state->workers[i].queue);
+    while (!g_sequence_iter_is_end (iter)) {
+      SchedulerRequest *request = g_sequence_get (iter);
+      GCancellable *cancellable = g_task_get_cancellable (request->task);
+
+      iter = g_sequence_iter_next (iter);
+
+      if (g_cancellable_is_cancelled (cancellable) ||
+          (all && !(keep_visible && request->visible))) {
+        scheduler_remove_request (state, request);
+        removed = g_list_prepend (removed, request);
+      }
+    }
+  }
+
+  return removed;
+}
+
+/* Fail requests that never ran, called with the state unlocked */
+static void
+scheduler_complete_dropped (GList *requests,
+                            gint code,
+                            const char *message)
+{
+  GList *l;
+
+  for (l = requests; l != NULL; l = l->next) {
+    SchedulerRequest *request = l->data;
+
+    if (!g_task_return_error_if_cancelled (request->task)) {
+      if (code == G_IO_ERROR_CANCELLED)
+        g_task_return_new_error (request->task, G_IO_ERROR, code,
+                                 "%s", message);
+      else
+        g_task_return_new_error (request->task, VTILE_MAPBOX_ERROR, code,
+                                 "%s", message);
+    }
+
+    scheduler_request_free (request);
+  }
+
+  g_list_free (requests);
+}
+
+/*
+ * Forget the context of a request that has stopped running, so it can
+ * be queued again. This is done before the result is returned, the
+ * callback may well queue the context again.
+ */
+static void
+scheduler_release_request (SchedulerState *state,
+                           SchedulerRequest *request)
+{
+  g_mutex_lock (&state->lock);
+  g_hash_table_remove (state->requests, request->ctx);
+  g_mutex_unlock (&state->lock);
+}
+
+static void
+scheduler_run_request (SchedulerState *state,
+                       SchedulerRequest *request)
+{
+  VTileMapboxRenderContext *ctx = request->ctx;
+  GCancellable *cancellable;
+  GCancellable *ctx_cancellable = NULL;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  guint tile_size;
+  GError *error = NULL;
+
+  cancellable = g_task_get_cancellable (request->task);
+  if (g_cancellable_is_cancelled (cancellable)) {
+    scheduler_release_request (state, request);
+    g_task_return_error_if_cancelled (request->task);
+    scheduler_request_free (request);
+    return;
+  }
+
+  /*
+   * Cancelling the request also stops the render once it has started.
+   * The cancellable of @ctx is only stood in for during the render.
+   */
+  if (cancellable) {
+    ctx_cancellable = vtile_mapbox_render_context_get_cancellable (ctx);
+    if (ctx_cancellable)
+      g_object_ref (ctx_cancellable);
+    vtile_mapbox_render_context_set_cancellable (ctx, cancellable);
+  }
+
+  tile_size = vtile_mapbox_render_context_get_tile_size (ctx);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        tile_size, tile_size);
+  cr = cairo_create (surface);
+
+  if (!vtile_mapbox_render_context_render (ctx, cr, &error)) {
+    cairo_surface_destroy (surface);
+    surface = NULL;
+  }
+  cairo_destroy (cr);
+
+  if (cancellable) {
+    vtile_mapbox_render_context_set_cancellable (ctx, ctx_cancellable);
+    if (ctx_cancellable)
+      g_object_unref (ctx_cancellable);
+  }
+
+  scheduler_release_request (state, request);
+
+  if (surface)
+    g_task_return_pointer (request->task, surface,
+                           (GDestroyNotify) cairo_surface_destroy);
+  else
+    g_task_return_error (request->task, error);
+
+  scheduler_request_free (request);
+}
+
+static gpointer
+scheduler_worker_thread (SchedulerWorker *worker)
+{
+  SchedulerState *state = worker->state;
+
+  g_mutex_lock (&state->lock);
+  for (;;) {
+    SchedulerRequest *request;
+
+    while (!state->quit && state->n_queued == 0)
+      g_cond_wait (&state->cond, &state->lock);
+
+    if (state->quit)
+      break;
+
+    request = scheduler_take_request (state, worker);
+    g_mutex_unlock (&state->lock);
+
+    scheduler_run_request (state, request);
+
+    g_mutex_lock (&state->lock);
+  }
+  g_mutex_unlock (&state->lock);
+
+  scheduler_state_unref (state);
+
+  return NULL;
+}
+
+static void
+vtile_mapbox_scheduler_set_property (GObject *object,
+                                     guint property_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+  VTileMapboxScheduler *scheduler = VTILE_MAPBOX_SCHEDULER (object);
+
+  switch (property_id)
+    {
+    case PROP_N_WORKERS:
+      scheduler->priv->n_workers = g_value_get_uint (value);
+      break;
+
+    case PROP_MAX_QUEUED:
+      scheduler->priv->max_queued = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+    }
+}
+
+static void
+vtile_mapbox_scheduler_get_property (GObject *object,
+                                     guint property_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+  VTileMapboxScheduler *scheduler = VTILE_MAPBOX_SCHEDULER (object);
+
+  switch (property_id)
+    {
+    case PROP_N_WORKERS:
+      g_value_set_uint (value, scheduler->priv->n_workers);
+      break;
+
+    case PROP_MAX_QUEUED:
+      g_value_set_uint (value, scheduler->priv->max_queued);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+    }
+}
+
+static void
+vtile_mapbox_scheduler_constructed (GObject *object)
+{
+  VTileMapboxScheduler *scheduler = VTILE_MAPBOX_SCHEDULER (object);
+  SchedulerState *state;
+  guint i;
+
+  if (scheduler->priv->n_workers == 0)
+    scheduler->priv->n_workers = g_get_num_processors ();
+
+  state = g_new0 (SchedulerState, 1);
+  state->ref_count = 1;
+  state->n_workers = scheduler->priv->n_workers;
+  state->max_queued = scheduler->priv->max_queued;
+  state->requests = g_hash_table_new (g_direct_hash, g_direct_equal);
+  state->workers = g_new0 (SchedulerWorker, state->n_workers);
+  g_mutex_init (&state->lock);
+  g_cond_init (&state->cond);
+
+  for (i = 0; i < state->n_workers; i++) {
+    SchedulerWorker *worker = &state->workers[i];
+
+    worker->state = scheduler_state_ref (state);
+    worker->queue = g_sequence_new (NULL);
+    worker->thread = g_thread_new ("vtile-render",
+                                   (GThreadFunc) scheduler_worker_thread,
+                                   worker);
+  }
+
+  scheduler->priv->state = state;
+
+  G_OBJECT_CLASS (vtile_mapbox_scheduler_parent_class)->constructed (object);
+}
+
+static void
+vtile_mapbox_scheduler_finalize (GObject *object)
+{
+  VTileMapboxScheduler *scheduler = VTILE_MAPBOX_SCHEDULER (object);
+  SchedulerState *state = scheduler->priv->state;
+  guint i;
+
+  /* Every queued request holds a reference on us, so no work is left */
+  g_mutex_lock (&state->lock);
+  state->quit = TRUE;
+  g_cond_broadcast (&state->cond);
+  g_mutex_unlock (&state->lock);
+
+  for (i = 0; i < state->n_workers; i++) {
+    GThread *thread = state->workers[i].thread;
+
+    if (thread == g_thread_self ())
+      g_thread_unref (thread);
+    else
+      g_thread_join (thread);
+  }
+
+  scheduler_state_unref (state);
+
+  G_OBJECT_CLASS (vtile_mapbox_scheduler_parent_class)->finalize (object);
+}
+
+static void
+vtile_mapbox_scheduler_class_init (VTileMapboxSchedulerClass *klass)
+{
+  GObjectClass *scheduler_class = G_OBJECT_CLASS (klass);
+  GParamSpec *pspec;
+
+  scheduler_class->constructed = vtile_mapbox_scheduler_constructed;
+  scheduler_class->finalize = vtile_mapbox_scheduler_finalize;
+  scheduler_class->get_property = vtile_mapbox_scheduler_get_property;
+  scheduler_class->set_property = vtile_mapbox_scheduler_set_property;
+
+  /**
+   * VTileMapboxScheduler:n-workers
+   *
+   * The number of render threads, 0 means one per processor.
+   */
+  pspec = g_param_spec_uint ("n-workers",
+                             "Workers",
+                             "The number of render threads",
+                             0,
+                             G_MAXUINT,
+                             0,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (scheduler_class, PROP_N_WORKERS, pspec);
+
+  /**
+   * VTileMapboxScheduler:max-queued
+   *
+   * The largest number of requests waiting to be rendered, 0 means
+   * no limit.
+   */
+  pspec = g_param_spec_uint ("max-queued",
+                             "Max queued",
+                             "The largest number of waiting requests",
+                             0,
+                             G_MAXUINT,
+                             0,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (scheduler_class, PROP_MAX_QUEUED, pspec);
+}
+
+static void
+vtile_mapbox_scheduler_init (VTileMapboxScheduler *scheduler)
+{
+  scheduler->priv = vtile_mapbox_scheduler_get_instance_private (scheduler);
+}
+
+/**
+ * vtile_mapbox_scheduler_new:
+ * @n_workers: the number of render threads, or 0 for one per processor.
+ * @max_queued: the largest number of waiting requests, or 0 for no limit.
+ *
+ * Returns: a new #VTileMapboxScheduler.
+ */
+VTileMapboxScheduler *
+vtile_mapbox_scheduler_new (guint n_workers,
+                            guint max_queued)
+{
+  return g_object_new (VTILE_TYPE_MAPBOX_SCHEDULER,
+                       "n-workers", n_workers,
+                       "max-queued", max_queued,
+                       NULL);
+}
+
+/**
+ * vtile_mapbox_scheduler_render_async:
+ * @scheduler: a #VTileMapboxScheduler.
+ * @ctx: the #VTileMapboxRenderContext to render.
+ * @priority: the priority of the request, lower values run first.
+ * @visible: whether the tile is currently on screen.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied.
+ * @user_data: the data to pass to callback function.
+ *
+ * Queue a render of @ctx into a new image surface of the tile size of
+ * @ctx. A context can only be queued once at a time: until its request
+ * has finished, queueing it again fails with %G_IO_ERROR_PENDING. The
+ * labels of the render can be found on @ctx once the request is finished.
+ *
+ * If @cancellable is set it stops the render in place of the
+ * cancellable of @ctx, which is put back once the render is done.
+ * Without one, the cancellable of @ctx still applies.
+ */
+void
+vtile_mapbox_scheduler_render_async (VTileMapboxScheduler *scheduler,
+                                     VTileMapboxRenderContext *ctx,
+                                     gint priority,
+                                     gboolean visible,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+  SchedulerState *state;
+  SchedulerRequest *request;
+  SchedulerRequest *rejected = NULL;
+  SchedulerWorker *worker = NULL;
+  GList *cancelled = NULL;
+  guint i;
+
+  g_return_if_fail (VTILE_IS_MAPBOX_SCHEDULER (scheduler));
+  g_return_if_fail (ctx != NULL);
+
+  state = scheduler->priv->state;
+
+  request = g_new0 (SchedulerRequest, 1);
+  request->task = g_task_new (scheduler, cancellable, callback, user_data);
+  request->ctx = vtile_mapbox_render_context_ref (ctx);
+  request->priority = priority;
+  request->visible = visible;
+  g_task_set_source_tag (request->task, vtile_mapbox_scheduler_render_async);
+  g_task_set_priority (request->task, priority);
+
+  g_mutex_lock (&state->lock);
+
+  if (g_hash_table_contains (state->requests, ctx)) {
+    g_mutex_unlock (&state->lock);
+    g_task_return_new_error (request->task, G_IO_ERROR, G_IO_ERROR_PENDING,
+                             "The render context is already queued or "
+                             "rendering");
+    scheduler_request_free (request);
+    return;
+  }
+
+  request->seq = state->seq++;
+
+  /* Make room, first by forgetting cancelled requests */
+  if (state->max_queued && state->n_queued >= state->max_queued) {
+    cancelled = scheduler_remove_requests (state, FALSE, FALSE);
+
+    if (state->n_queued >= state->max_queued) {
+      SchedulerRequest *worst = scheduler_find_least_urgent (state);
+
+      if (scheduler_request_compare (request, worst, NULL) > 0) {
+        rejected = request;
+        request = NULL;
+      } else {
+        scheduler_remove_request (state, worst);
+        rejected = worst;
+      }
+    }
+  }
+
+  if (request) {
+    /* Queue on the worker with the least work waiting */
+    for (i = 0; i < state->n_workers; i++) {
+      if (!worker ||
+          g_sequence_get_length (state->workers[i].queue) <
+          g_sequence_get_length (worker->queue))
+        worker = &state->workers[i];
+    }
+
+    request->queue = worker->queue;
+    request->iter = g_sequence_insert_sorted (worker->queue, request,
+                                              scheduler_request_compare,
+                                              NULL);
+    g_hash_table_insert (state->requests, ctx, request);
+    state->n_queued++;
+    g_cond_signal (&state->cond);
+  }
+
+  g_mutex_unlock (&state->lock);
+
+  scheduler_complete_dropped (cancelled, G_IO_ERROR_CANCELLED,
+                              "The render request was cancelled");
+  if (rejected)
+    scheduler_complete_dropped (g_list_prepend (NULL, rejected),
+                                VTILE_MAPBOX_ERROR_QUEUE_FULL,
+                                "Too many queued render requests");
+}
+
+/**
+ * vtile_mapbox_scheduler_render_finish:
+ * @scheduler: a #VTileMapboxScheduler.
+ * @result: a #GAsyncResult.
+ * @error: a #GError, or %NULL.
+ *
+ * Returns: (transfer full): the rendered tile, or %NULL on error.
+ * %G_IO_ERROR_CANCELLED is returned if the request was cancelled or
+ * dropped, %VTILE_MAPBOX_ERROR_QUEUE_FULL if it was pushed out by more
+ * urgent requests.
+ */
+cairo_surface_t *
+vtile_mapbox_scheduler_render_finish (VTileMapboxScheduler *scheduler,
+                                      GAsyncResult *result,
+                                      GError **error)
+{
+  g_return_val_if_fail (VTILE_IS_MAPBOX_SCHEDULER (scheduler), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, scheduler), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * vtile_mapbox_scheduler_set_visible:
+ * @scheduler: a #VTileMapboxScheduler.
+ * @ctx: a queued #VTileMapboxRenderContext.
+ * @visible: whether the tile is currently on screen.
+ *
+ * Update the visibility of a queued request, visible requests are
+ * rendered before any invisible ones.
+ *
+ * Returns: %TRUE if @ctx was still waiting to be rendered.
+ */
+gboolean
+vtile_mapbox_scheduler_set_visible (VTileMapboxScheduler *scheduler,
+                                    VTileMapboxRenderContext *ctx,
+                                    gboolean visible)
+{
+  SchedulerState *state;
+  SchedulerRequest *request;
+
+  g_return_val_if_fail (VTILE_IS_MAPBOX_SCHEDULER (scheduler), FALSE);
+  g_return_val_if_fail (ctx != NULL, FALSE);
+
+  state = scheduler->priv->state;
+
+  g_mutex_lock (&state->lock);
+  request = g_hash_table_lookup (state->requests, ctx);
+
+  /* A running request has no queue to be moved in */
+  if (request && !request->iter)
+    request = NULL;
+
+  if (request && request->visible != visible) {
+    request->visible = visible;
+    g_sequence_sort_changed (request->iter, scheduler_request_compare, NULL);
+  }
+  g_mutex_unlock (&state->lock);
+
+  return request != NULL;
+}
+
+/**
+ * vtile_mapbox_scheduler_drop_queued:
+ * @scheduler: a #VTileMapboxScheduler.
+ * @keep_visible: whether to keep requests marked as visible.
+ *
+ * Drop requests that have not started rendering, they finish with
+ * %G_IO_ERROR_CANCELLED. Renders already running are not affected.
+ *
+ * Returns: the number of dropped requests.
+ */
+guint
+vtile_mapbox_scheduler_drop_queued (VTileMapboxScheduler *scheduler,
+                                    gboolean keep_visible)
+{
+  SchedulerState *state;
+  GList *dropped;
+  guint n_dropped;
+
+  g_return_val_if_fail (VTILE_IS_MAPBOX_SCHEDULER (scheduler), 0);
+
+  state = scheduler->priv->state;
+
+  g_mutex_lock (&state->lock);
+  dropped = scheduler_remove_requests (state, TRUE, keep_visible);
+  g_mutex_unlock (&state->lock);
+
+  n_dropped = g_list_length (dropped);
+  scheduler_complete_dropped (dropped, G_IO_ERROR_CANCELLED,
+                              "The render request was dropped");
+
+  return n_dropped;
+}
+
+/**
+ * vtile_mapbox_scheduler_get_n_queued:
+ * @scheduler: a #VTileMapboxScheduler.
+ *
+ * Returns: the number of requests waiting to be rendered.
+ */
+guint
+vtile_mapbox_scheduler_get_n_queued (VTileMapboxScheduler *scheduler)
+{
+  SchedulerState *state;
+  guint n_queued;
+
+  g_return_val_if_fail (VTILE_IS_MAPBOX_SCHEDULER (scheduler), 0);
+
+  state = scheduler->priv->state;
+
+  g_mutex_lock (&state->lock);
+  n_queued = state->n_queued;
+  g_mutex_unlock (&state->lock);
+
+  return n_queued;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_SCHEDULER_H__
+#define __VECTOR_TILE_MAPBOX_SCHEDULER_H__
+
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "vector-tile-mapbox.h"
+
+G_BEGIN_DECLS
+
+GType vtile_mapbox_scheduler_get_type (void) G_GNUC_CONST;
+
+#define VTILE_TYPE_MAPBOX_SCHEDULER            (vtile_mapbox_scheduler_get_type ())
+#define VTILE_MAPBOX_SCHEDULER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), VTILE_TYPE_MAPBOX_SCHEDULER, VTileMapboxScheduler))
+#define VTILE_IS_MAPBOX_SCHEDULER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), VTILE_TYPE_MAPBOX_SCHEDULER))
+#define VTILE_MAPBOX_SCHEDULER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), VTILE_TYPE_MAPBOX_SCHEDULER, VTileMapboxSchedulerClass))
+#define VTILE_IS_MAPBOX_SCHEDULER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), VTILE_TYPE_MAPBOX_SCHEDULER))
+#define VTILE_MAPBOX_SCHEDULER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), VTILE_TYPE_MAPBOX_SCHEDULER, VTileMapboxSchedulerClass))
+
+typedef struct _VTileMapboxScheduler        VTileMapboxScheduler;
+typedef struct _VTileMapboxSchedulerClass   VTileMapboxSchedulerClass;
+typedef struct _VTileMapboxSchedulerPrivate VTileMapboxSchedulerPrivate;
+
+struct _VTileMapboxScheduler {
+  /* <private> */
+  GObject parent_instance;
+  VTileMapboxSchedulerPrivate *priv;
+};
+
+struct _VTileMapboxSchedulerClass {
+  /* <private> */
+  GObjectClass parent_class;
+};
+
+VTileMapboxScheduler *vtile_mapbox_scheduler_new (guint n_workers,
+                                                  guint max_queued);
+
+void vtile_mapbox_scheduler_render_async (VTileMapboxScheduler *scheduler,
+                                          VTileMapboxRenderContext *ctx,
+                                          gint priority,
+                                          gboolean visible,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
+
+cairo_surface_t *
+vtile_mapbox_scheduler_render_finish (VTileMapboxScheduler *scheduler,
+                                      GAsyncResult *result,
+                                      GError **error);
+
+gboolean vtile_mapbox_scheduler_set_visible (VTileMapboxScheduler *scheduler,
+                                             VTileMapboxRenderContext *ctx,
+                                             gboolean visible);
+
+guint vtile_mapbox_scheduler_drop_queued (VTileMapboxScheduler *scheduler,
+                                          gboolean keep_visible);
+
+guint vtile_mapbox_scheduler_get_n_queued (VTileMapboxScheduler *scheduler);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_SCHEDULER_H__ */
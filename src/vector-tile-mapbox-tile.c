@@ -0,0 +1,173 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+
+#include "vector-tile-mapbox.h"
+#include "vector-tile-mapbox-tile.h"
+#include "vector-tile-mapbox-private.h"
+
+/**
+ * vtile_mapbox_tile_new:
+ * @data: (array length=size): the data to decode the tile from.
+ * @size: the size of @data.
+ * @error: a #GError, or %NULL.
+ *
+ * Decode a Mapbox vector tile. @data is not referenced after this
+ * function returns.
+ *
+ * Returns: a new #VTileMapboxTile, or %NULL on error.
+ * Use vtile_mapbox_tile_unref() when done.
+ */
+VTileMapboxTile *
+vtile_mapbox_tile_new (const guint8 *data,
+                       gsize size,
+                       GError **error)
+{
+  VTileMapboxTile *tile;
+  VectorTile__Tile *decoded;
+
+  g_return_val_if_fail (data != NULL, NULL);
+
+  decoded = vector_tile__tile__unpack (NULL, size, data);
+  if (!decoded) {
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
+                 "Failed to load tile.");
+    return NULL;
+  }
+
+  tile = g_new0 (VTileMapboxTile, 1);
+  tile->ref_count = 1;
+  tile->tile = decoded;
+
+  return tile;
+}
+
+/**
+ * vtile_mapbox_tile_new_from_file:
+ * @filename: the file to load a tile from.
+ * @error: a #GError, or %NULL.
+ *
+ * Returns: a new #VTileMapboxTile, or %NULL on error.
+ * Use vtile_mapbox_tile_unref() when done.
+ */
+VTileMapboxTile *
+vtile_mapbox_tile_new_from_file (const char *filename,
+                                 GError **error)
+{
+  VTileMapboxTile *tile;
+  GFile *file;
+  GFileInfo *info;
+  GFileInputStream *stream;
+  goffset size;
+  gssize bytes_read;
+  gboolean status;
+  guint8 *tile_buffer;
+  GError *read_error = NULL;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  file = g_file_new_for_path (filename);
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE,
+                            NULL,
+                            NULL);
+  if (!info) {
+    g_object_unref (file);
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
+                 "Failed to load tile.");
+    return NULL;
+  }
+
+  size = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  stream = g_file_read (file, NULL, &read_error);
+  g_object_unref (file);
+  if (!stream) {
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
+                 "Failed to load tile: %s", read_error->message);
+    g_error_free (read_error);
+    return NULL;
+  }
+
+  tile_buffer = g_malloc (size);
+  status = g_input_stream_read_all ((GInputStream *) stream,
+                                    tile_buffer,
+                                    size,
+                                    &bytes_read,
+                                    NULL,
+                                    &read_error);
+  g_object_unref (stream);
+
+  if (!status) {
+    g_free (tile_buffer);
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
+                 "Failed to load tile: %s", read_error->message);
+    g_error_free (read_error);
+    return NULL;
+  }
+
+  /* The file shrank after its size was looked up */
+  if (bytes_read != size) {
+    g_free (tile_buffer);
+    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
+                 "Failed to load tile: short read.");
+    return NULL;
+  }
+
+  tile = vtile_mapbox_tile_new (tile_buffer, size, error);
+  g_free (tile_buffer);
+
+  return tile;
+}
+
+/**
+ * vtile_mapbox_tile_ref:
+ * @tile: a #VTileMapboxTile.
+ *
+ * Returns: @tile
+ */
+VTileMapboxTile *
+vtile_mapbox_tile_ref (VTileMapboxTile *tile)
+{
+  g_return_val_if_fail (tile != NULL, NULL);
+
+  g_atomic_int_inc (&tile->ref_count);
+
+  return tile;
+}
+
+/**
+ * vtile_mapbox_tile_unref:
+ * @tile: a #VTileMapboxTile.
+ *
+ * Release a reference to @tile, the tile is freed when the last
+ * reference is gone.
+ */
+void
+vtile_mapbox_tile_unref (VTileMapboxTile *tile)
+{
+  g_return_if_fail (tile != NULL);
+
+  if (!g_atomic_int_dec_and_test (&tile->ref_count))
+    return;
+
+  vector_tile__tile__free_unpacked (tile->tile, NULL);
+  g_free (tile);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_MAPBOX_TILE_H__
+#define __VECTOR_TILE_MAPBOX_TILE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VTileMapboxTile:
+ *
+ * A decoded Mapbox vector tile. The tile is immutable once decoded and
+ * can be shared between any number of renders and threads.
+ */
+typedef struct _VTileMapboxTile VTileMapboxTile;
+
+VTileMapboxTile *vtile_mapbox_tile_new (const guint8 *data,
+                                        gsize size,
+                                        GError **error);
+VTileMapboxTile *vtile_mapbox_tile_new_from_file (const char *filename,
+                                                  GError **error);
+VTileMapboxTile *vtile_mapbox_tile_ref (VTileMapboxTile *tile);
+void vtile_mapbox_tile_unref (VTileMapboxTile *tile);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_MAPBOX_TILE_H__ */
@@ -20,11 +20,16 @@
 #include <pango/pango.h>
 #include <pango/pangocairo.h>
 #include <math.h>
+#include <string.h>
 
 #include "vector-tile-mapcss-private.h"
 #include "vector-tile-mapcss-style.h"
 #include "vector-tile-mapbox.h"
+#include "vector-tile-mapbox-private.h"
 #include "vector-tile-boxed.h"
+#include "vector-tile-label-atlas.h"
+#include "vector-tile-label-grid.h"
+#include "vector-tile-worker-pool.h"
 #include "vector_tile.pb-c.h"
 
 /**
@@ -83,6 +88,11 @@
  *   return 0;
  * }
  * ]|
+ *
+ * A #VTileMapbox renders one tile at a time. To render the same decoded
+ * tile concurrently, at several sizes or with several stylesheets, decode
+ * it once into a #VTileMapboxTile and create one #VTileMapboxRenderContext
+ * per render.
  */
 
 
@@ -98,13 +108,45 @@
  */
 #define ZIGZAG_DECODE(val) (((val) >> 1) ^ (-((val) & 1)))
 
+/*
+ * Tiles with fewer features than this have their styles resolved on the
+ * calling thread, handing them out to workers costs more than it saves.
+ */
+#define MAPBOX_PARALLEL_MIN_FEATURES 1024
+#define MAPBOX_PARALLEL_CHUNK_SIZE   256
+
+/* Lowered by the tests, to have the small bundled tiles take the path */
+static guint mapbox_parallel_min_features = MAPBOX_PARALLEL_MIN_FEATURES;
+static guint mapbox_parallel_chunk_size = MAPBOX_PARALLEL_CHUNK_SIZE;
+
+/*
+ * Label angles are rounded to whole degrees, so that labels along
+ * nearly parallel lines share a cached rendering.
+ */
+#define MAPBOX_LABEL_ANGLE_STEP (G_PI / 180)
+
+/* The number of shaped label texts each thread keeps around */
+#define MAPBOX_MAX_SHAPED_TEXTS 512
+
+/* The cell size, in tile pixels, of the grid labels are placed on */
+#define MAPBOX_LABEL_GRID_CELL_SIZE 32
+
+/* The largest width and height of a label atlas surface */
+#define MAPBOX_LABEL_ATLAS_SIZE 1024
+
+/* Line vertices of a draft closer than this, in pixels, are dropped */
+#define MAPBOX_DRAFT_TOLERANCE 2.0
+
 enum {
   MAPBOX_CMD_MOVE_TO = 1,
   MAPBOX_CMD_LINE_TO = 2,
   MAPBOX_CMD_CLOSE_PATH = 7
 };
 
-/* This is the rendering layers and order we currently use */
+/*
+ * This is the rendering layers and order we currently use, bit n of
+ * VTileMapboxLayerFlags stands for layer n.
+ */
 enum {
   MAPBOX_RENDER_LAYER_EARTH,
   MAPBOX_RENDER_LAYER_LANDUSE,
@@ -118,6 +160,12 @@ enum {
   NUM_RENDER_LAYERS
 };
 
+/* Layers a degraded render draws only while its time budget lasts */
+#define MAPBOX_OPTIONAL_LAYERS                                          \
+  ((1 << MAPBOX_RENDER_LAYER_PLACES) |                                  \
+   (1 << MAPBOX_RENDER_LAYER_BUILDINGS) |                               \
+   (1 << MAPBOX_RENDER_LAYER_POI))
+
 /*
  * The index represents the order of the layer, and the primary tag
  * tells us what key value to use for the "kind" value.
@@ -128,6 +176,53 @@ typedef struct {
 } MapboxLayerData;
 
 
+/*
+ * The features queued on a render layer, and the labels they produced
+ * and the tile pixels they touched while the layer was rendered.
+ */
+typedef struct {
+  GList *strokes;
+  GList *casings;
+  GList *labels;
+  cairo_rectangle_int_t damage;
+} MapboxRenderLayer;
+
+/*
+ * A label found while rendering. Once measured the label is drawn with
+ * the matrix, its anchor goes at x, y and the box is the text on the
+ * tile. Labels along lines are dropped if they are longer than the
+ * line. The z-index and the size of the feature decide which labels
+ * win a place. The layer index is the render layer of the feature.
+ */
+typedef struct {
+  VTileMapboxLabelKey key;
+  VTileMapboxLabel label;
+  cairo_matrix_t matrix;
+  gint x;
+  gint y;
+  guint max_width;
+  VTileLabelBox box;
+  guint layer_index;
+
+  guint z_index;
+  guint size;
+  char *uid;
+  gboolean placed;
+
+  guint atlas_page;
+  gint atlas_x;
+  gint atlas_y;
+} MapboxLabel;
+
+/*
+ * What the plans of a tile for several stylesheets share of a feature:
+ * its tags and its decoded path.
+ */
+typedef struct {
+  GHashTable *tags;
+  cairo_path_t *path;
+} MapboxSharedFeature;
+
 /*
  * This represents all we need to know to render a feature. It is collected
  * during the first pass where we determine which layer a feature belongs to.
@@ -136,30 +231,126 @@ typedef struct {
   VectorTile__Tile__Feature *feature;
   VTileMapCSSStyle *style;
   guint layer_index;
-  cairo_t *layer_cr;
+  MapboxRenderLayer *render_layer;
   GHashTable *tags;
-  VTileMapbox *mapbox;
+  VTileMapboxRenderContext *ctx;
+  MapboxSharedFeature *shared;
 
   guint z_index;
   guint extent;
   guint tile_size;
+
+  /* The bounds of the geometry in tile pixels, once looked for */
+  gboolean has_bounds;
+  cairo_rectangle_int_t bounds;
 } MapboxFeatureData;
 
+/* A resolved text style and the attributes to lay text out with */
 typedef struct {
-  GList *strokes;
-  GList *casings;
-} MapboxRenderLayer;
+  VTileMapboxTextStyle font;
+  PangoAttrList *attr_list;
+} MapboxTextFont;
+
+/* A label text laid out, and shaped, in one of the fonts */
+typedef struct {
+  char *text;
+  MapboxTextFont *font;
+  PangoLayout *layout;
+} MapboxShapedText;
+
+/*
+ * Pango objects are not thread-safe, each thread that renders labels
+ * keeps its own context, fonts and shaped texts.
+ */
+typedef struct {
+  PangoContext *context;
+  GHashTable *fonts;
+  GHashTable *shaped_texts;
+} MapboxTextThread;
+
+/* A feature waiting for its tags and style to be resolved */
+typedef struct {
+  VectorTile__Tile__Feature *feature;
+  VectorTile__Tile__Layer *layer;
+  char *primary_tag;
+  guint layer_index;
+
+  MapboxFeatureData *data;
+  guint render_layer;
+} MapboxFeatureJob;
+
+typedef struct {
+  VTileMapboxRenderContext *ctx;
+  MapboxFeatureJob *jobs;
+  guint n_jobs;
+  guint chunk_size;
+} MapboxFeatureBatch;
+
+/* The render layers drawn by worker threads, in render order */
+typedef struct {
+  VTileMapboxRenderContext *ctx;
+  guint layers[NUM_RENDER_LAYERS];
+  cairo_surface_t *surfaces[NUM_RENDER_LAYERS];
+
+  gint width;
+  gint height;
+  gdouble x_offset;
+  gdouble y_offset;
+  cairo_matrix_t matrix;
+  cairo_antialias_t antialias;
+  gdouble tolerance;
+  cairo_font_options_t *font_options;
+} MapboxLayerBatch;
+
 
+/*
+ * Everything that belongs to a single render. The decoded tile and the
+ * stylesheet are shared and only read from.
+ */
+struct _VTileMapboxRenderContext {
+  volatile gint ref_count;
+
+  VTileMapboxTile *tile;
+  VTileMapCSS *stylesheet;
+  guint tile_size;
+  guint zoom_level;
+  VTileMapboxRenderFlags flags;
+  GCancellable *cancellable;
+  gint64 deadline;
+  volatile gint stopped;
+
+  gint64 budget;
+  gint64 budget_start;
+  gint64 budget_end;
+  gboolean out_of_budget;
+  VTileMapboxLayerFlags skipped_layers;
+  VTileMapboxLabelCache *label_cache;
+  VTileMapboxLabelRegistry *label_registry;
+  guint tile_x;
+  guint tile_y;
+  VTileMapboxLayerDoneFunc layer_done;
+  gpointer layer_done_data;
+
+  /* Set while only a region of the tile is rendered */
+  gboolean has_region;
+  cairo_rectangle_int_t region;
+
+  /* Set while the context builds a plan instead of drawing */
+  VTileMapboxRenderPlan *plan;
+  MapboxSharedFeature *shared_features;
+
+  MapboxRenderLayer render_layers[NUM_RENDER_LAYERS];
+  GList *labels;
+  GList *texts;
+  GList *atlases;
+};
 
 struct _VTileMapboxPrivate {
-  guint8 *data;
-  gssize size;
   guint tile_size;
   guint zoom_level;
 
-  VectorTile__Tile *tile;
+  VTileMapboxTile *tile;
   GList *texts;
-  MapboxRenderLayer *render_layers[NUM_RENDER_LAYERS];
   VTileMapCSS *stylesheet;
 };
 
@@ -181,8 +372,12 @@ G_DEFINE_TYPE_WITH_PRIVATE (VTileMapbox, vtile_mapbox, G_TYPE_OBJECT)
 void
 vtile_mapbox_text_free (VTileMapboxText *text)
 {
-  cairo_surface_destroy (text->surface);
+  if (text->surface)
+    cairo_surface_destroy (text->surface);
+  if (text->lazy)
+    vtile_mapbox_lazy_label_unref (text->lazy);
   g_free (text->uid);
+  g_free (text->text);
   g_free (text);
 }
 
@@ -250,13 +445,12 @@ static void
 vtile_mapbox_finalize (GObject *object)
 {
   VTileMapbox *mapbox = (VTileMapbox *) object;
-  gint i;
 
-  for (i = 0; i < NUM_RENDER_LAYERS; i++)
-    g_free (mapbox->priv->render_layers[i]);
-  
+  g_list_free_full (mapbox->priv->texts,
+                    (GDestroyNotify) vtile_mapbox_text_free);
+
   if (mapbox->priv->tile)
-    vector_tile__tile__free_unpacked (mapbox->priv->tile, NULL);
+    vtile_mapbox_tile_unref (mapbox->priv->tile);
 
   G_OBJECT_CLASS (vtile_mapbox_parent_class)->finalize (object);
 }
@@ -305,13 +499,9 @@ vtile_mapbox_class_init (VTileMapboxClass *klass)
 static void
 vtile_mapbox_init (VTileMapbox *mapbox)
 {
-  gint i;
-
   mapbox->priv = vtile_mapbox_get_instance_private (mapbox);
   mapbox->priv->tile = NULL;
   mapbox->priv->texts = NULL;
-  for (i = 0; i < NUM_RENDER_LAYERS; i++)
-    mapbox->priv->render_layers[i] = g_new0 (MapboxRenderLayer, 1);
 }
 
 /**
@@ -337,6 +527,16 @@ vtile_mapbox_new (guint tile_size,
   return mapbox;
 }
 
+static void
+vtile_mapbox_set_tile (VTileMapbox *mapbox,
+                       VTileMapboxTile *tile)
+{
+  if (mapbox->priv->tile)
+    vtile_mapbox_tile_unref (mapbox->priv->tile);
+
+  mapbox->priv->tile = tile;
+}
+
 /**
  * vtile_mapbox_load:
  * @data: the data to load tile from.
@@ -351,17 +551,16 @@ vtile_mapbox_load (VTileMapbox *mapbox,
                    gsize size,
                    GError **error)
 {
+  VTileMapboxTile *tile;
+
   g_return_val_if_fail (mapbox != NULL, FALSE);
   g_return_val_if_fail (data != NULL, FALSE);
-  
-  mapbox->priv->tile = vector_tile__tile__unpack (NULL,
-                                                  size,
-                                                  data);
-  if (!mapbox->priv->tile) {
-    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
-                 "Failed to load tile.");
+
+  tile = vtile_mapbox_tile_new (data, size, error);
+  if (!tile)
     return FALSE;
-  }
+
+  vtile_mapbox_set_tile (mapbox, tile);
 
   return TRUE;
 }
@@ -379,64 +578,33 @@ vtile_mapbox_load_from_file (VTileMapbox *mapbox,
                              const char *filename,
                              GError **error)
 {
-  GFile *file;
-  GFileInfo *info;
-  GFileInputStream *stream;
-  goffset size;
-  gssize bytes_read;
-  gboolean status;
-  guint8 *tile_buffer;
-  
+  VTileMapboxTile *tile;
+
   g_return_val_if_fail (mapbox != NULL, FALSE);
   g_return_val_if_fail (filename != NULL, FALSE);
 
-  file = g_file_new_for_path (filename);
-  info = g_file_query_info (file,
-                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                            G_FILE_QUERY_INFO_NONE,
-                            NULL,
-                            NULL);
-  if (!info) {
-    g_object_unref (file);
-    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
-                 "Failed to load tile.");
+  tile = vtile_mapbox_tile_new_from_file (filename, error);
+  if (!tile)
     return FALSE;
-  }
 
-  size = g_file_info_get_size (info);
-  tile_buffer = g_malloc (size);
-
-  stream = g_file_read (file, NULL, NULL);
-  status = g_input_stream_read_all ((GInputStream *) stream,
-                                    tile_buffer,
-                                    size,
-                                    &bytes_read,
-                                    NULL,
-                                    NULL);
-  if (!status) {
-    g_free (tile_buffer);
-    g_object_unref (file);
-    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
-                 "Failed to load tile.");
-    return FALSE;
-  }
+  vtile_mapbox_set_tile (mapbox, tile);
 
-  g_object_unref (file);
-  g_object_unref (info);
-  g_object_unref (stream);
+  return TRUE;
+}
 
-  mapbox->priv->tile = vector_tile__tile__unpack (NULL,
-                                                  size,
-                                                  tile_buffer);
-  g_free (tile_buffer);
-  
-  if (!mapbox->priv->tile) {
-    g_set_error (error, VTILE_MAPBOX_ERROR, VTILE_MAPBOX_ERROR_LOAD,
-                 "Failed to load tile.");
-    return FALSE;
-  }
+/**
+ * vtile_mapbox_get_tile:
+ * @mapbox: a #VTileMapbox object.
+ *
+ * Returns: (transfer none) (nullable): the decoded tile, or %NULL if no
+ * tile has been loaded. Use vtile_mapbox_tile_ref() to keep it around.
+ */
+VTileMapboxTile *
+vtile_mapbox_get_tile (VTileMapbox *mapbox)
+{
+  g_return_val_if_fail (mapbox != NULL, NULL);
 
-  return TRUE;
+  return mapbox->priv->tile;
 }
 
 /**
@@ -509,7 +677,7 @@ mapbox_get_tags (VectorTile__Tile__Feature *feature,
 }
 
 static VTileMapCSSStyle *
-mapbox_feature_get_style (VTileMapbox *mapbox,
+mapbox_feature_get_style (VTileMapboxRenderContext *ctx,
                           GHashTable *tags,
                           VectorTile__Tile__Feature *feature,
                           VectorTile__Tile__Layer *layer)
@@ -519,24 +687,24 @@ mapbox_feature_get_style (VTileMapbox *mapbox,
   switch (feature->type)
     {
     case VECTOR_TILE__TILE__GEOM_TYPE__POLYGON:
-      style = vtile_mapcss_get_style (mapbox->priv->stylesheet,
+      style = vtile_mapcss_get_style (ctx->stylesheet,
                                       VTILE_MAPCSS_SELECTOR_TYPE_WAY,
-                                      tags, mapbox->priv->zoom_level);
+                                      tags, ctx->zoom_level);
       break;
     case VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING:
-      style = vtile_mapcss_get_style (mapbox->priv->stylesheet,
+      style = vtile_mapcss_get_style (ctx->stylesheet,
                                       VTILE_MAPCSS_SELECTOR_TYPE_WAY,
-                                      tags, mapbox->priv->zoom_level);
+                                      tags, ctx->zoom_level);
       break;
     case VECTOR_TILE__TILE__GEOM_TYPE__POINT:
-      style = vtile_mapcss_get_style (mapbox->priv->stylesheet,
+      style = vtile_mapcss_get_style (ctx->stylesheet,
                                       VTILE_MAPCSS_SELECTOR_TYPE_NODE,
-                                      tags, mapbox->priv->zoom_level);
+                                      tags, ctx->zoom_level);
       break;
     default:
-      style = vtile_mapcss_get_style (mapbox->priv->stylesheet,
+      style = vtile_mapcss_get_style (ctx->stylesheet,
                                       VTILE_MAPCSS_SELECTOR_TYPE_NODE,
-                                      tags, mapbox->priv->zoom_level);
+                                      tags, ctx->zoom_level);
       break;
     }
 
@@ -569,17 +737,24 @@ mapbox_feature_get_style (VTileMapbox *mapbox,
   | ==== relative MoveTo(+3, +6)
   `> [00001 001] = command type 1 (MoveTo), length 1
 
-  The original position is (0,0).
+  The original position is (0,0). A ClosePath does not move the cursor,
+  the next MoveTo is relative to the last vertex of the ring. cairo moves
+  its current point back to the start of the ring instead, so the cursor
+  is kept here and the path drawn with absolute coordinates.
 */
 static void
 mapbox_draw_path (MapboxFeatureData *data, cairo_t *cr)
 {
- gint n;
+  gint n;
   gdouble scale;
   gint p_geom = 0;
+  gboolean draft;
+  gdouble tolerance;
+  gint32 x = 0, y = 0;
+  gint32 last_x = 0, last_y = 0;
 
-  /* We need this since we are using relative move_to and line_to */
-  cairo_move_to (cr, 0, 0);
+  draft = (data->ctx->flags & VTILE_MAPBOX_RENDER_DRAFT) != 0;
+  tolerance = MAPBOX_DRAFT_TOLERANCE * data->extent / data->tile_size;
 
   cairo_save (cr);
   scale = (gdouble) data->tile_size / data->extent;
@@ -605,10 +780,25 @@ mapbox_draw_path (MapboxFeatureData *data, cairo_t *cr)
         parameter = data->feature->geometry[++p_geom];
         dy = ZIGZAG_DECODE (parameter);
 
-        if (cmd == MAPBOX_CMD_MOVE_TO)
-          cairo_rel_move_to (cr, dx, dy);
-        else
-          cairo_rel_line_to (cr, dx, dy);
+        x += dx;
+        y += dy;
+
+        /*
+         * A draft drops vertices close to the last one drawn, but keeps
+         * the last vertex of a run, so lines end where they should and
+         * rings close on the right spot.
+         */
+        if (cmd == MAPBOX_CMD_MOVE_TO) {
+          cairo_move_to (cr, x, y);
+        } else if (!draft || n == length - 1 ||
+                   ABS (x - last_x) >= tolerance ||
+                   ABS (y - last_y) >= tolerance) {
+          cairo_line_to (cr, x, y);
+        } else {
+          continue;
+        }
+        last_x = x;
+        last_y = y;
       }
     } else {
       /* MAPBOX_CMD_CLOSE_PATH */
@@ -622,231 +812,539 @@ mapbox_draw_path (MapboxFeatureData *data, cairo_t *cr)
 }
 
 
-/* Draw the geometry of a feature, this will be a line or a polygon */
+/* Turn a MapCSS line cap into a cairo one, -1 if there is none */
+static gint
+mapbox_line_cap (VTileMapCSSEnumValue value)
+{
+  switch (value) {
+  case VTILE_MAPCSS_VALUE_NONE:
+    return CAIRO_LINE_CAP_BUTT;
+  case VTILE_MAPCSS_VALUE_ROUND:
+    return CAIRO_LINE_CAP_ROUND;
+  case VTILE_MAPCSS_VALUE_SQUARE:
+    return CAIRO_LINE_CAP_SQUARE;
+  default:
+    return -1;
+  }
+}
+
+/* Turn a MapCSS line join into a cairo one, -1 if there is none */
+static gint
+mapbox_line_join (VTileMapCSSEnumValue value)
+{
+  switch (value) {
+  case VTILE_MAPCSS_VALUE_ROUND:
+    return CAIRO_LINE_JOIN_ROUND;
+  case VTILE_MAPCSS_VALUE_MITER:
+    return CAIRO_LINE_JOIN_MITER;
+  case VTILE_MAPCSS_VALUE_BEVEL:
+    return CAIRO_LINE_JOIN_BEVEL;
+  default:
+    return -1;
+  }
+}
+
+/* Polygons are filled with the same colour, line or casing */
+static void
+mapbox_get_fill_params (MapboxFeatureData *data,
+                        VTileMapboxDrawParams *params)
+{
+  VTileMapCSSColor *color;
+
+  params->fill = data->feature->type == VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
+  if (!params->fill)
+    return;
+
+  params->fill_opacity = vtile_mapcss_style_get_num (data->style,
+                                                     "fill-opacity");
+  color = vtile_mapcss_style_get_color (data->style, "fill-color");
+  params->fill_color = *color;
+}
+
+/*
+ * Draw the path of a feature on @cr and return a copy of it. A feature
+ * shared between plans is only decoded once, its path is then not drawn
+ * on @cr again. Hand the path back with mapbox_feature_path_release().
+ */
 static cairo_path_t *
-mapbox_render_geometry (MapboxFeatureData *data,
-                        cairo_t *cr)
+mapbox_feature_path (MapboxFeatureData *data,
+                     cairo_t *cr)
 {
   cairo_path_t *path;
 
+  if (data->shared && data->shared->path)
+    return data->shared->path;
+
   mapbox_draw_path (data, cr);
   path = cairo_copy_path (cr);
+  if (data->shared)
+    data->shared->path = path;
 
-  if (data->feature->type == VECTOR_TILE__TILE__GEOM_TYPE__POLYGON) {
-    VTileMapCSSColor *color;
-    gdouble opacity;
+  return path;
+}
 
-    cairo_stroke_preserve (cr);
+static void
+mapbox_feature_path_release (MapboxFeatureData *data,
+                             cairo_path_t *path)
+{
+  if (!data->shared || data->shared->path != path)
+    cairo_path_destroy (path);
+}
 
-    cairo_save (cr);
-    cairo_clip (cr);
-    opacity = vtile_mapcss_style_get_num (data->style, "fill-opacity");
-    color = vtile_mapcss_style_get_color (data->style, "fill-color");
-    cairo_set_source_rgba (cr,
-                           color->r,
-                           color->g,
-                           color->b,
-                           opacity);
-    cairo_paint (cr);
-    cairo_restore (cr);
+/*
+ * How far outside of its path a feature can draw. Miter joins can reach
+ * out far from the path, the pad is big enough for the default miter
+ * limit of 10.
+ */
+static gdouble
+mapbox_params_pad (const VTileMapboxDrawParams *params)
+{
+  gdouble pad = 1;
+
+  if (params->stroke) {
+    pad += params->width / 2;
+    if (params->line_join != CAIRO_LINE_JOIN_ROUND &&
+        params->line_join != CAIRO_LINE_JOIN_BEVEL)
+      pad *= 10;
+  }
+
+  return pad;
+}
+
+/* Grow the damaged region of the layer of a feature by the path on @cr */
+static void
+mapbox_add_damage (MapboxFeatureData *data,
+                   const VTileMapboxDrawParams *params,
+                   cairo_t *cr)
+{
+  cairo_rectangle_int_t *damage = &data->render_layer->damage;
+  gdouble x1, y1, x2, y2;
+  gdouble pad = mapbox_params_pad (params);
+  gint left, top, right, bottom;
+
+  cairo_path_extents (cr, &x1, &y1, &x2, &y2);
+  if (x1 >= x2 && y1 >= y2)
+    return;
+
+  left = MAX (0, floor (x1 - pad));
+  top = MAX (0, floor (y1 - pad));
+  right = MIN ((gint) data->tile_size, ceil (x2 + pad));
+  bottom = MIN ((gint) data->tile_size, ceil (y2 + pad));
+  if (left >= right || top >= bottom)
+    return;
+
+  if (damage->width > 0) {
+    left = MIN (left, damage->x);
+    top = MIN (top, damage->y);
+    right = MAX (right, damage->x + damage->width);
+    bottom = MAX (bottom, damage->y + damage->height);
+  }
+
+  damage->x = left;
+  damage->y = top;
+  damage->width = right - left;
+  damage->height = bottom - top;
+}
+
+/* Find the bounds of the geometry of a feature, without drawing it */
+static void
+mapbox_feature_bounds (MapboxFeatureData *data)
+{
+  VectorTile__Tile__Feature *feature = data->feature;
+  gint32 x = 0, y = 0;
+  gint32 x1 = G_MAXINT, y1 = G_MAXINT;
+  gint32 x2 = G_MININT, y2 = G_MININT;
+  gdouble scale;
+  gint p_geom = 0;
+  gint n;
+
+  while (p_geom < feature->n_geometry) {
+    gint cmd = feature->geometry[p_geom] & 7L;
+    gint length = feature->geometry[p_geom] >> 3;
+
+    if (cmd == MAPBOX_CMD_MOVE_TO || cmd == MAPBOX_CMD_LINE_TO) {
+      for (n = 0; n < length; n++) {
+        guint32 parameter;
+
+        parameter = feature->geometry[++p_geom];
+        x += ZIGZAG_DECODE (parameter);
+        parameter = feature->geometry[++p_geom];
+        y += ZIGZAG_DECODE (parameter);
+
+        x1 = MIN (x1, x);
+        y1 = MIN (y1, y);
+        x2 = MAX (x2, x);
+        y2 = MAX (y2, y);
+      }
+    }
+
+    p_geom += 1;
+  }
+
+  data->has_bounds = TRUE;
+  if (x1 > x2) {
+    data->bounds.width = data->bounds.height = 0;
+    return;
+  }
+
+  scale = (gdouble) data->tile_size / data->extent;
+  data->bounds.x = floor (x1 * scale);
+  data->bounds.y = floor (y1 * scale);
+  data->bounds.width = ceil (x2 * scale) - data->bounds.x;
+  data->bounds.height = ceil (y2 * scale) - data->bounds.y;
+}
+
+/*
+ * Whether a feature drawn with @params, or a point if @params is %NULL,
+ * can touch the region being rendered.
+ */
+static gboolean
+mapbox_feature_in_region (MapboxFeatureData *data,
+                          const VTileMapboxDrawParams *params)
+{
+  const cairo_rectangle_int_t *region = &data->ctx->region;
+  gint pad;
+
+  if (!data->ctx->has_region)
+    return TRUE;
+
+  if (!data->has_bounds)
+    mapbox_feature_bounds (data);
+
+  pad = params ? ceil (mapbox_params_pad (params)) : 0;
+
+  return data->bounds.x - pad <= region->x + region->width &&
+    data->bounds.y - pad <= region->y + region->height &&
+    data->bounds.x + data->bounds.width + pad >= region->x &&
+    data->bounds.y + data->bounds.height + pad >= region->y;
+}
+
+/*
+ * Draw the geometry of a feature, this will be a line or a polygon.
+ * While a plan is built the path is added to it instead.
+ */
+static cairo_path_t *
+mapbox_render_geometry (MapboxFeatureData *data,
+                        const VTileMapboxDrawParams *params,
+                        cairo_t *cr)
+{
+  cairo_path_t *path;
+
+  path = mapbox_feature_path (data, cr);
+
+  if (data->ctx->plan) {
+    vtile_mapbox_render_plan_add (data->ctx->plan, params, path);
+    cairo_new_path (cr);
   } else {
-    cairo_stroke (cr);
+    if (data->ctx->layer_done)
+      mapbox_add_damage (data, params, cr);
+    vtile_mapbox_draw_params_paint (params, cr,
+                                    data->ctx->flags &
+                                    VTILE_MAPBOX_RENDER_FAST_FILLS);
   }
 
   return path;
 }
 
-/* Render the casings for a line, this is done by drawing a thicker version
- * of the line before we draw the actual line. So the width of the casing
- * will be: line_width + (2 * casing_width).
-*/
-static void
-mapbox_render_casings (MapboxFeatureData *data,
-                       cairo_t *cr)
+/*
+ * Find how the casing of a line is drawn, the casing is a thicker
+ * version of the line drawn before the actual line. So the width of
+ * the casing will be: line_width + (2 * casing_width). Returns FALSE if
+ * the line has no casing.
+ */
+static gboolean
+mapbox_get_casing_params (MapboxFeatureData *data,
+                          VTileMapboxDrawParams *params)
 {
   VTileMapCSSColor *color;
-  VTileMapCSSDash *c_dash, *dash;
+  VTileMapCSSDash *c_dash;
   VTileMapCSSEnumValue c_line_cap, line_cap;
   VTileMapCSSEnumValue c_line_join, line_join;
   gdouble c_width, width;
-  gdouble opacity;
 
   c_width = vtile_mapcss_style_get_num (data->style, "casing-width");
   if (!c_width)
-    return;
+    return FALSE;
 
   width = vtile_mapcss_style_get_num (data->style, "width");
-  dash = vtile_mapcss_style_get_dash (data->style, "dashes");
   line_cap = vtile_mapcss_style_get_enum (data->style, "linecap");
   line_join = vtile_mapcss_style_get_enum (data->style, "linejoin");
 
-  opacity = vtile_mapcss_style_get_num (data->style, "casing-opacity");
+  params->opacity = vtile_mapcss_style_get_num (data->style,
+                                                "casing-opacity");
   color = vtile_mapcss_style_get_color (data->style, "casing-color");
-  cairo_set_source_rgba (cr,
-                        color->r,
-                        color->g,
-                        color->b,
-                        opacity);
-  c_width = width + (2 * c_width);
-  cairo_set_line_width (cr, c_width);
+  params->color = *color;
+  params->width = width + (2 * c_width);
+  params->stroke = TRUE;
 
   c_line_cap = vtile_mapcss_style_get_enum (data->style, "casing-linecap");
-  if (c_line_cap > 0) {
-    switch (c_line_cap) {
-    case VTILE_MAPCSS_VALUE_NONE:
-      cairo_set_line_cap (cr, CAIRO_LINE_CAP_BUTT);
-      break;
-    case VTILE_MAPCSS_VALUE_ROUND:
-      cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
-      break;
-    case VTILE_MAPCSS_VALUE_SQUARE:
-      cairo_set_line_cap (cr, CAIRO_LINE_CAP_SQUARE);
-      break;
-    }
-  } else {
-    cairo_set_line_cap (cr, line_cap);
-  }
+  if (c_line_cap > 0)
+    params->line_cap = mapbox_line_cap (c_line_cap);
+  else
+    params->line_cap = line_cap;
 
   c_line_join  = vtile_mapcss_style_get_enum (data->style, "casing-linejoin");
-  if (c_line_join > 0) {
-    switch (c_line_join) {
-    case VTILE_MAPCSS_VALUE_ROUND:
-      cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
-      break;
-    case VTILE_MAPCSS_VALUE_MITER:
-      cairo_set_line_join (cr, CAIRO_LINE_JOIN_MITER);
-      break;
-    case VTILE_MAPCSS_VALUE_BEVEL:
-      cairo_set_line_join (cr, CAIRO_LINE_JOIN_BEVEL);
-      break;
-    }
-  } else {
-    cairo_set_line_join (cr, line_join);
-  }
+  if (c_line_join > 0)
+    params->line_join = mapbox_line_join (c_line_join);
+  else
+    params->line_join = line_join;
 
   c_dash = vtile_mapcss_style_get_dash (data->style, "casing-dashes");
+  params->has_dash = c_dash != NULL;
   if (c_dash)
-    cairo_set_dash (cr, c_dash->dashes, c_dash->num_dashes, 0);
+    params->dash = *c_dash;
 
-  cairo_path_destroy (mapbox_render_geometry (data, cr));
+  mapbox_get_fill_params (data, params);
+
+  return TRUE;
 }
 
-/* Render all lines, fetch the style data and draw the geometry */
-static cairo_path_t *
-mapbox_render_lines (MapboxFeatureData *data,
-                     cairo_t *cr)
+/* Render the casings for a line */
+static void
+mapbox_render_casings (MapboxFeatureData *data,
+                       cairo_t *cr)
+{
+  VTileMapboxDrawParams params;
+
+  if (mapbox_get_casing_params (data, &params) &&
+      mapbox_feature_in_region (data, &params))
+    mapbox_feature_path_release (data,
+                                 mapbox_render_geometry (data, &params, cr));
+}
+
+/* Find how a line, or the outline of a polygon, is drawn */
+static void
+mapbox_get_line_params (MapboxFeatureData *data,
+                        VTileMapboxDrawParams *params)
 {
   VTileMapCSSColor *color;
   VTileMapCSSDash *dash;
-  VTileMapCSSEnumValue line_cap;
-  VTileMapCSSEnumValue line_join;
-  gdouble opacity;
-  gdouble width;
 
-  width = vtile_mapcss_style_get_num (data->style, "width");
-  dash = vtile_mapcss_style_get_dash (data->style, "dashes");
-  line_cap = vtile_mapcss_style_get_enum (data->style, "linecap");
-  line_join = vtile_mapcss_style_get_enum (data->style, "linejoin");
+  params->width = vtile_mapcss_style_get_num (data->style, "width");
+  params->line_cap =
+    mapbox_line_cap (vtile_mapcss_style_get_enum (data->style, "linecap"));
+  params->line_join =
+    mapbox_line_join (vtile_mapcss_style_get_enum (data->style, "linejoin"));
 
-  opacity = vtile_mapcss_style_get_num (data->style, "opacity");
+  params->opacity = vtile_mapcss_style_get_num (data->style, "opacity");
   color = vtile_mapcss_style_get_color (data->style, "color");
-  cairo_set_source_rgba (cr,
-                         color->r,
-                         color->g,
-                         color->b,
-                         opacity);
+  params->color = *color;
 
-  cairo_set_line_width (cr, width);
-  switch (line_cap) {
-  case VTILE_MAPCSS_VALUE_NONE:
-    cairo_set_line_cap (cr, CAIRO_LINE_CAP_BUTT);
-    break;
-  case VTILE_MAPCSS_VALUE_ROUND:
-    cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
-    break;
-  case VTILE_MAPCSS_VALUE_SQUARE:
-    cairo_set_line_cap (cr, CAIRO_LINE_CAP_SQUARE);
-    break;
-  }
+  dash = vtile_mapcss_style_get_dash (data->style, "dashes");
+  params->has_dash = TRUE;
+  params->dash = *dash;
 
-  switch (line_join) {
-  case VTILE_MAPCSS_VALUE_ROUND:
-    cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
-    break;
-  case VTILE_MAPCSS_VALUE_MITER:
-    cairo_set_line_join (cr, CAIRO_LINE_JOIN_MITER);
-    break;
-  case VTILE_MAPCSS_VALUE_BEVEL:
-    cairo_set_line_join (cr, CAIRO_LINE_JOIN_BEVEL);
-    break;
-  }
+  mapbox_get_fill_params (data, params);
+
+  /* A draft only fills its polygons */
+  params->stroke = !(params->fill &&
+                     data->ctx->flags & VTILE_MAPBOX_RENDER_DRAFT);
+}
+
+/* Render all lines, fetch the style data and draw the geometry */
+static cairo_path_t *
+mapbox_render_lines (MapboxFeatureData *data,
+                     cairo_t *cr)
+{
+  VTileMapboxDrawParams params;
 
-  cairo_set_dash (cr, dash->dashes, dash->num_dashes, 0);
+  mapbox_get_line_params (data, &params);
+  if (!mapbox_feature_in_region (data, &params))
+    return NULL;
 
-  return mapbox_render_geometry (data, cr);
+  return mapbox_render_geometry (data, &params, cr);
 }
 
-static PangoAttrList *
-mapbox_get_text_attributes (MapboxFeatureData *data)
+static void
+mapbox_get_text_style (MapboxFeatureData *data,
+                       VTileMapboxTextStyle *font)
 {
-  PangoAttrList *attr_list;
-  PangoFontDescription *desc;
-  PangoStyle style;
-  PangoVariant variant;
-  PangoWeight weight;
-  gdouble size;
   gint enum_value;
-  char *family;
-  VTileMapCSSColor *color;
-
-  attr_list = pango_attr_list_new ();
 
-  desc = pango_font_description_new ();
-  family = vtile_mapcss_style_get_str (data->style, "font-family");
-  pango_font_description_set_family (desc, family);
+  font->family = vtile_mapcss_style_get_str (data->style, "font-family");
 
   enum_value = vtile_mapcss_style_get_enum (data->style, "font-style");
   if (enum_value == VTILE_MAPCSS_VALUE_NORMAL)
-    style = PANGO_STYLE_NORMAL;
+    font->style = PANGO_STYLE_NORMAL;
   else
-    style = PANGO_STYLE_ITALIC;
-  pango_font_description_set_style (desc, style);
+    font->style = PANGO_STYLE_ITALIC;
 
   enum_value = vtile_mapcss_style_get_enum (data->style, "font-variant");
   if (enum_value == VTILE_MAPCSS_VALUE_NORMAL)
-    style = PANGO_VARIANT_NORMAL;
+    font->variant = PANGO_VARIANT_NORMAL;
   else
-    style = PANGO_VARIANT_SMALL_CAPS;
-  pango_font_description_set_variant (desc, variant);
+    font->variant = PANGO_VARIANT_SMALL_CAPS;
 
   enum_value = vtile_mapcss_style_get_enum (data->style, "font-weight");
   if (enum_value == VTILE_MAPCSS_VALUE_NORMAL)
-    weight = PANGO_WEIGHT_NORMAL;
+    font->weight = PANGO_WEIGHT_NORMAL;
   else
-    style = PANGO_WEIGHT_BOLD;
-  pango_font_description_set_weight (desc, weight);
+    font->weight = PANGO_WEIGHT_BOLD;
+
+  font->size =
+    (gint) vtile_mapcss_style_get_num (data->style, "font-size") * PANGO_SCALE;
+
+  enum_value = vtile_mapcss_style_get_enum (data->style, "text-decoration");
+  font->underline = enum_value == VTILE_MAPCSS_VALUE_UNDERLINE;
+}
+
+static PangoAttrList *
+mapbox_get_text_attributes (const VTileMapboxTextStyle *font)
+{
+  PangoAttrList *attr_list;
+  PangoFontDescription *desc;
+
+  attr_list = pango_attr_list_new ();
 
-  size = vtile_mapcss_style_get_num (data->style, "font-size");
-  pango_font_description_set_size (desc, (gint) size * PANGO_SCALE);
+  desc = pango_font_description_new ();
+  pango_font_description_set_family (desc, font->family);
+  pango_font_description_set_style (desc, font->style);
+  pango_font_description_set_variant (desc, font->variant);
+  pango_font_description_set_weight (desc, font->weight);
+  pango_font_description_set_size (desc, font->size);
 
   pango_attr_list_insert (attr_list, pango_attr_font_desc_new (desc));
   pango_font_description_free (desc);
 
-  enum_value = vtile_mapcss_style_get_enum (data->style, "text-decoration");
-  if (enum_value == VTILE_MAPCSS_VALUE_UNDERLINE)
+  if (font->underline)
     pango_attr_list_insert (attr_list,
                             pango_attr_underline_new (PANGO_UNDERLINE_SINGLE));
 
   return attr_list;
 }
 
+static void
+mapbox_text_font_free (MapboxTextFont *font)
+{
+  g_free ((char *) font->font.family);
+  pango_attr_list_unref (font->attr_list);
+  g_free (font);
+}
+
+static guint
+mapbox_shaped_text_hash (gconstpointer data)
+{
+  const MapboxShapedText *shaped = data;
+
+  return g_str_hash (shaped->text) * 31 + g_direct_hash (shaped->font);
+}
+
+static gboolean
+mapbox_shaped_text_equal (gconstpointer data_a,
+                          gconstpointer data_b)
+{
+  const MapboxShapedText *a = data_a;
+  const MapboxShapedText *b = data_b;
+
+  return a->font == b->font && g_str_equal (a->text, b->text);
+}
+
+static void
+mapbox_shaped_text_free (MapboxShapedText *shaped)
+{
+  g_free (shaped->text);
+  g_object_unref (shaped->layout);
+  g_free (shaped);
+}
+
+static void
+mapbox_text_thread_free (MapboxTextThread *thread)
+{
+  g_hash_table_destroy (thread->shaped_texts);
+  g_hash_table_destroy (thread->fonts);
+  g_object_unref (thread->context);
+  g_free (thread);
+}
+
+static GPrivate mapbox_text_thread =
+  G_PRIVATE_INIT ((GDestroyNotify) mapbox_text_thread_free);
+
+static MapboxTextThread *
+mapbox_get_text_thread (void)
+{
+  MapboxTextThread *thread;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  thread = g_private_get (&mapbox_text_thread);
+  if (thread)
+    return thread;
+
+  thread = g_new0 (MapboxTextThread, 1);
+  thread->context =
+    pango_font_map_create_context (pango_cairo_font_map_get_default ());
+
+  /* Labels are drawn to image surfaces, use their font options */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 1, 1);
+  cr = cairo_create (surface);
+  pango_cairo_update_context (cr, thread->context);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  thread->fonts = g_hash_table_new_full (vtile_mapbox_text_style_hash,
+                                         vtile_mapbox_text_style_equal,
+                                         NULL,
+                                         (GDestroyNotify) mapbox_text_font_free);
+  thread->shaped_texts =
+    g_hash_table_new_full (mapbox_shaped_text_hash,
+                           mapbox_shaped_text_equal,
+                           (GDestroyNotify) mapbox_shaped_text_free,
+                           NULL);
+  g_private_set (&mapbox_text_thread, thread);
+
+  return thread;
+}
+
+/*
+ * Get @text laid out in @font. The layout belongs to the calling thread
+ * and stays valid until the next call.
+ */
+static PangoLayout *
+mapbox_get_text_layout (const char *text,
+                        const VTileMapboxTextStyle *font)
+{
+  MapboxTextThread *thread = mapbox_get_text_thread ();
+  MapboxTextFont *text_font;
+  MapboxShapedText lookup;
+  MapboxShapedText *shaped;
+
+  text_font = g_hash_table_lookup (thread->fonts, font);
+  if (!text_font) {
+    text_font = g_new (MapboxTextFont, 1);
+    text_font->font = *font;
+    text_font->font.family = g_strdup (font->family);
+    text_font->attr_list = mapbox_get_text_attributes (font);
+    g_hash_table_insert (thread->fonts, &text_font->font, text_font);
+  }
+
+  lookup.text = (char *) text;
+  lookup.font = text_font;
+  shaped = g_hash_table_lookup (thread->shaped_texts, &lookup);
+  if (shaped)
+    return shaped->layout;
+
+  if (g_hash_table_size (thread->shaped_texts) >= MAPBOX_MAX_SHAPED_TEXTS)
+    g_hash_table_remove_all (thread->shaped_texts);
+
+  shaped = g_new (MapboxShapedText, 1);
+  shaped->text = g_strdup (text);
+  shaped->font = text_font;
+  shaped->layout = pango_layout_new (thread->context);
+  pango_layout_set_text (shaped->layout, text, -1);
+  pango_layout_set_attributes (shaped->layout, text_font->attr_list);
+  g_hash_table_add (thread->shaped_texts, shaped);
+
+  return shaped->layout;
+}
+
 static void
 mapbox_find_text_pos (MapboxFeatureData *data,
                       cairo_path_t *path,
                       guint *x_out,
                       guint *y_out,
                       gdouble *angle,
-                      guint *length)
+                      guint *length,
+                      guint *size)
 {
   cairo_path_data_t *path_data;
   gint i;
@@ -922,14 +1420,17 @@ mapbox_find_text_pos (MapboxFeatureData *data,
 
     *x_out = lowest_x + (width / 2);
     *y_out = lowest_y + (height / 2);
+    *size = width * height;
   } else if (data->feature->type == VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING) {
     guint line_width = vtile_mapcss_style_get_num (data->style, "width");
 
     *y_out = *y_out - line_width;
     *x_out = *x_out - line_width / 2;
+    *size = *length;
   } else {
     *x_out = x;
     *y_out = y;
+    *size = 0;
   }
 }
 
@@ -991,128 +1492,332 @@ find_new_bounding_box (cairo_matrix_t matrix,
   }
 }
 
+/*
+ * Work out the size of a label laid out @width by @height pixels, where
+ * its anchor is and the matrix that draws it on its surface.
+ */
 static void
-mapbox_add_text (MapboxFeatureData *data,
-                 cairo_t *cr,
-                 cairo_path_t *path,
-                 char *text)
+mapbox_measure_label (const VTileMapboxLabelKey *key,
+                      gint width,
+                      gint height,
+                      VTileMapboxLabel *label,
+                      cairo_matrix_t *matrix)
 {
-  PangoAttrList *attr_list;
-  PangoLayout *layout;
-  VTileMapCSSColor *color;
-  gint halo_width;
-  cairo_surface_t *target, *rotated;
-  cairo_matrix_t matrix;
-  cairo_t *text_cr, *rotated_cr;
-  VTileMapboxText *m_text = g_new0 (VTileMapboxText, 1);
-  gint width, height;
-  gint32 x;
-  gint32 y;
-  gdouble angle = 0.0;
-  guint length = 0;
   gint min_x;
   gint max_x;
   gint min_y;
   gint max_y;
 
-  mapbox_find_text_pos (data, path, &x, &y, &angle, &length);
-  attr_list = mapbox_get_text_attributes (data);
-
-  layout = pango_cairo_create_layout (cr);
-  pango_layout_set_text (layout, text, -1);
-  pango_layout_set_attributes (layout, attr_list);
-  pango_attr_list_unref (attr_list);
-  pango_layout_get_pixel_size (layout, &width, &height);
-
-  if (length && width > length) {
-    g_object_unref (layout);
-    g_free (m_text);
-    return;
-  }
+  label->surface = NULL;
+  label->layout_width = width;
 
-  target = cairo_get_target (cr);
-  m_text->offset_x = x;
-  m_text->offset_y = y;
-  m_text->uid = g_strdup (g_hash_table_lookup (data->tags, "uid"));
-
-  if (angle != 0.0) {
+  if (key->angle != 0) {
     /* Translate to center point and rotate with angle */
-    cairo_save (cr);
-    cairo_identity_matrix (cr);
-    cairo_translate (cr, width / 2, height / 2);
-    cairo_rotate (cr, angle);
-    cairo_translate (cr, -width / 2, -height / 2);
-    cairo_get_matrix (cr, &matrix);
-    cairo_restore (cr);
+    cairo_matrix_init_translate (matrix, width / 2, height / 2);
+    cairo_matrix_rotate (matrix, key->angle * MAPBOX_LABEL_ANGLE_STEP);
+    cairo_matrix_translate (matrix, -width / 2, -height / 2);
 
     /* Find the bounding box of the text after rotation */
-    find_new_bounding_box (matrix, width, height,
+    find_new_bounding_box (*matrix, width, height,
                            &min_x, &max_x, &min_y, &max_y);
 
-    m_text->width = max_x - min_x;
-    m_text->height = max_y - min_y;
+    label->width = max_x - min_x;
+    label->height = max_y - min_y;
 
     /* Get the new position of the old origo */
-    m_text->offset_x -= matrix.x0 - min_x;
-    m_text->offset_y -= matrix.y0 - min_y;
+    label->anchor_x = matrix->x0 - min_x;
+    label->anchor_y = matrix->y0 - min_y;
+
+    /* Make sure we draw to the correct place */
+    matrix->x0 -= min_x;
+    matrix->y0 -= min_y;
   } else {
-    m_text->width = width;
-    m_text->height = height;
-    m_text->offset_x -= (width / 2);
-    m_text->offset_y -= (height / 2);
-    min_x = 0;
-    min_y = 0;
+    cairo_matrix_init_identity (matrix);
+    label->width = width;
+    label->height = height;
+    label->anchor_x = width / 2;
+    label->anchor_y = height / 2;
+  }
+}
+
+/*
+ * Grow the alpha mask @src by @radius pixels into @dst, taking the
+ * largest value under a disc around each pixel. A pixel at distance d
+ * is covered by a pixel grown by @radius for radius + 1 - d of its
+ * width, so the ring at the rim of the disc is weighted by that part.
+ * That keeps halos of a fraction of a pixel, such as the common radius
+ * of 1, from vanishing. Each offset of the disc is a byte-wise maximum
+ * of two rows, which compilers turn into vector instructions.
+ */
+static void
+mapbox_dilate_mask (const guchar *src,
+                    guchar *dst,
+                    gint stride,
+                    gint width,
+                    gint height,
+                    gdouble radius)
+{
+  gint reach = ceil (radius);
+  gint size = 2 * reach + 1;
+  guint *weights;
+  gint y;
 
-    cairo_get_matrix (cr, &matrix);
+  /* The coverage of each offset, in 1/256 */
+  weights = g_new (guint, size * size);
+  for (y = -reach; y <= reach; y++) {
+    gint x;
+
+    for (x = -reach; x <= reach; x++) {
+      gdouble coverage = radius + 1 - sqrt (x * x + y * y);
+
+      weights[(y + reach) * size + x + reach] =
+        CLAMP (coverage, 0.0, 1.0) * 256 + 0.5;
+    }
   }
 
-  rotated = cairo_surface_create_similar (target,
-                                          CAIRO_CONTENT_COLOR_ALPHA,
-                                          m_text->width,
-                                          m_text->height);
+  memset (dst, 0, stride * height);
 
-  m_text->surface = cairo_surface_create_similar (target,
-                                                  CAIRO_CONTENT_COLOR_ALPHA,
-                                                  m_text->width,
-                                                  m_text->height);
+  for (y = 0; y < height; y++) {
+    guchar *dst_row = dst + y * stride;
+    gint dy;
 
-  /* Make sure we draw to the correct place */
-  cairo_surface_set_device_offset (rotated, -min_x, -min_y);
-  rotated_cr = cairo_create (rotated);
-  cairo_set_matrix (rotated_cr, &matrix);
-  pango_cairo_update_layout (rotated_cr, layout);
-  pango_cairo_layout_path (rotated_cr, layout);
+    for (dy = -reach; dy <= reach; dy++) {
+      const guchar *src_row;
+      gint dx;
 
-  color = vtile_mapcss_style_get_color (data->style, "text-color");
-  halo_width = vtile_mapcss_style_get_num (data->style, "text-halo-radius");
-  if (halo_width > 0) {
-    VTileMapCSSColor *halo_color;
-
-    cairo_set_line_width (rotated_cr, halo_width);
-    halo_color = vtile_mapcss_style_get_color (data->style, "text-halo-color");
-    cairo_set_source_rgb (rotated_cr,
-                          halo_color->r,
-                          halo_color->g,
-                          halo_color->b);
+      if (y + dy < 0 || y + dy >= height)
+        continue;
+
+      src_row = src + (y + dy) * stride;
+
+      for (dx = -reach; dx <= reach; dx++) {
+        guint weight = weights[(dy + reach) * size + dx + reach];
+        gint start = MAX (0, -dx);
+        gint end = MIN (width, width - dx);
+        gint x;
+
+        if (weight == 0)
+          continue;
+
+        if (weight >= 256) {
+          for (x = start; x < end; x++)
+            dst_row[x] = MAX (dst_row[x], src_row[x + dx]);
+        } else {
+          for (x = start; x < end; x++) {
+            guchar value = (src_row[x + dx] * weight) >> 8;
+
+            dst_row[x] = MAX (dst_row[x], value);
+          }
+        }
+      }
+    }
+  }
+
+  g_free (weights);
+}
+
+/*
+ * Draw the glyphs of a label once into an alpha mask and grow it into
+ * the halo, instead of stroking the outlines. The glyphs are drawn
+ * from Pango's glyph cache rather than turned into paths.
+ */
+static void
+mapbox_rasterize_label_masked (const VTileMapboxLabelKey *key,
+                               const cairo_matrix_t *matrix,
+                               PangoLayout *layout,
+                               cairo_t *text_cr)
+{
+  cairo_surface_t *glyphs, *halo;
+  const VTileMapCSSColor *halo_color;
+  gdouble line_width;
+  cairo_t *cr;
+  gint width, height, stride;
+
+  width = cairo_image_surface_get_width (cairo_get_target (text_cr));
+  height = cairo_image_surface_get_height (cairo_get_target (text_cr));
+
+  glyphs = cairo_image_surface_create (CAIRO_FORMAT_A8, width, height);
+  cr = cairo_create (glyphs);
+  cairo_set_matrix (cr, matrix);
+  pango_cairo_show_layout (cr, layout);
+  cairo_destroy (cr);
+  cairo_surface_flush (glyphs);
+
+  /* Labels without a halo used a stroke of cairo's default width */
+  if (key->halo_radius > 0) {
+    line_width = key->halo_radius;
+    halo_color = &key->halo_color;
   } else {
-    cairo_set_source_rgb (rotated_cr, color->r, color->g, color->b);
+    line_width = 2.0;
+    halo_color = &key->color;
+  }
+
+  halo = cairo_image_surface_create (CAIRO_FORMAT_A8, width, height);
+  stride = cairo_image_surface_get_stride (glyphs);
+  g_assert (stride == cairo_image_surface_get_stride (halo));
+  mapbox_dilate_mask (cairo_image_surface_get_data (glyphs),
+                      cairo_image_surface_get_data (halo),
+                      stride, width, height, line_width / 2);
+  cairo_surface_mark_dirty (halo);
+
+  cairo_set_source_rgb (text_cr, halo_color->r, halo_color->g, halo_color->b);
+  cairo_mask_surface (text_cr, halo, 0, 0);
+  cairo_set_source_rgb (text_cr, key->color.r, key->color.g, key->color.b);
+  cairo_mask_surface (text_cr, glyphs, 0, 0);
+
+  cairo_surface_destroy (halo);
+  cairo_surface_destroy (glyphs);
+}
+
+/*
+ * Draw a measured label. The surface is an image surface drawn without
+ * any transformation other than the rotation of the label.
+ */
+static void
+mapbox_rasterize_label (const VTileMapboxLabelKey *key,
+                        const cairo_matrix_t *matrix,
+                        VTileMapboxLabel *label)
+{
+  PangoLayout *layout;
+  cairo_t *text_cr;
+
+  layout = mapbox_get_text_layout (key->text, &key->font);
+
+  label->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                               label->width,
+                                               label->height);
+  text_cr = cairo_create (label->surface);
+
+  if (key->mask_halo) {
+    mapbox_rasterize_label_masked (key, matrix, layout, text_cr);
+    cairo_destroy (text_cr);
+    cairo_surface_flush (label->surface);
+    return;
   }
-  cairo_stroke_preserve (rotated_cr);
-  cairo_set_source_rgb (rotated_cr, color->r, color->g, color->b);
-  cairo_fill (rotated_cr);
 
-  text_cr = cairo_create (m_text->surface);
-  cairo_set_source_surface (text_cr, rotated, -min_x, -min_y);
-  cairo_paint(text_cr);
-  cairo_surface_destroy (rotated);
-  cairo_destroy (rotated_cr);
+  cairo_set_matrix (text_cr, matrix);
+  pango_cairo_layout_path (text_cr, layout);
+
+  if (key->halo_radius > 0) {
+    cairo_set_line_width (text_cr, key->halo_radius);
+    cairo_set_source_rgb (text_cr,
+                          key->halo_color.r,
+                          key->halo_color.g,
+                          key->halo_color.b);
+  } else {
+    cairo_set_source_rgb (text_cr, key->color.r, key->color.g, key->color.b);
+  }
+  cairo_stroke_preserve (text_cr);
+  cairo_set_source_rgb (text_cr, key->color.r, key->color.g, key->color.b);
+  cairo_fill (text_cr);
   cairo_destroy (text_cr);
 
-  data->mapbox->priv->texts = g_list_prepend (data->mapbox->priv->texts,
-                                              m_text);
-  g_object_unref (layout);
+  cairo_surface_flush (label->surface);
+}
+
+/* Find a measured label in @cache or draw it and add it */
+static void
+mapbox_get_label_surface (VTileMapboxLabelCache *cache,
+                          const VTileMapboxLabelKey *key,
+                          const cairo_matrix_t *matrix,
+                          VTileMapboxLabel *label)
+{
+  if (cache && vtile_mapbox_label_cache_lookup (cache, key, label))
+    return;
+
+  mapbox_rasterize_label (key, matrix, label);
+  if (cache)
+    vtile_mapbox_label_cache_insert (cache, key, label);
+}
+
+static void
+mapbox_label_free (MapboxLabel *label)
+{
+  g_free ((char *) label->key.text);
+  g_free ((char *) label->key.font.family);
+  if (label->label.surface)
+    cairo_surface_destroy (label->label.surface);
+  g_free (label->uid);
+  g_free (label);
+}
+
+/* Find the corners of the @width by @height text of @label on the tile */
+static void
+mapbox_label_set_box (MapboxLabel *label,
+                      gint width,
+                      gint height)
+{
+  gdouble corners[4][2] = {
+    { 0, 0 },
+    { width, 0 },
+    { width, height },
+    { 0, height }
+  };
+  gint i;
+
+  for (i = 0; i < 4; i++) {
+    gdouble x = corners[i][0];
+    gdouble y = corners[i][1];
+
+    cairo_matrix_transform_point (&label->matrix, &x, &y);
+    label->box.x[i] = label->x - label->label.anchor_x + x;
+    label->box.y[i] = label->y - label->label.anchor_y + y;
+  }
 }
 
+/*
+ * Find the position and style of a label, it is measured and drawn in
+ * the label phase of the render.
+ */
+static void
+mapbox_add_text (MapboxFeatureData *data,
+                 cairo_path_t *path,
+                 char *text)
+{
+  MapboxLabel *label;
+  VTileMapCSSColor *color;
+  gint32 x;
+  gint32 y;
+  gdouble angle = 0.0;
+  guint length = 0;
+  guint size = 0;
+
+  mapbox_find_text_pos (data, path, &x, &y, &angle, &length, &size);
+
+  /* Labels anchored outside of the rendered region are left out */
+  if (data->ctx->has_region &&
+      (x < data->ctx->region.x ||
+       x >= data->ctx->region.x + data->ctx->region.width ||
+       y < data->ctx->region.y ||
+       y >= data->ctx->region.y + data->ctx->region.height))
+    return;
+
+  label = g_new0 (MapboxLabel, 1);
+  label->key.text = g_strdup (text);
+  mapbox_get_text_style (data, &label->key.font);
+  label->key.font.family = g_strdup (label->key.font.family);
+  color = vtile_mapcss_style_get_color (data->style, "text-color");
+  label->key.color = *color;
+  label->key.halo_radius = vtile_mapcss_style_get_num (data->style,
+                                                       "text-halo-radius");
+  if (label->key.halo_radius > 0) {
+    color = vtile_mapcss_style_get_color (data->style, "text-halo-color");
+    label->key.halo_color = *color;
+  }
+  label->key.angle = (gint) round (angle / MAPBOX_LABEL_ANGLE_STEP);
+  label->key.mask_halo =
+    (data->ctx->flags & VTILE_MAPBOX_RENDER_MASK_HALOS) != 0;
+
+  label->x = x;
+  label->y = y;
+  label->max_width = length;
+  label->z_index = data->z_index;
+  label->size = size;
+  label->uid = g_strdup (g_hash_table_lookup (data->tags, "uid"));
+
+  data->render_layer->labels = g_list_prepend (data->render_layer->labels,
+                                               label);
+}
 
 static void
 mapbox_render_feature (MapboxFeatureData *data,
@@ -1125,22 +1830,33 @@ mapbox_render_feature (MapboxFeatureData *data,
   if (data->feature->type == VECTOR_TILE__TILE__GEOM_TYPE__POLYGON ||
       data->feature->type == VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING) {
     path = mapbox_render_lines (data, cr);
-  } else {
-    mapbox_draw_path (data, cr);
-    path = cairo_copy_path (cr);
+  } else if (!(data->ctx->flags & VTILE_MAPBOX_RENDER_DRAFT) &&
+             mapbox_feature_in_region (data, NULL)) {
+    path = mapbox_feature_path (data, cr);
+  }
+
+  /* Drafts have no labels */
+  if (data->ctx->flags & VTILE_MAPBOX_RENDER_DRAFT) {
+    if (path)
+      mapbox_feature_path_release (data, path);
+    return;
   }
 
   if (path) {
     text_tag = vtile_mapcss_style_get_str (data->style, "text");
     if (text_tag && (text = g_hash_table_lookup (data->tags, text_tag))) {
-        mapbox_add_text (data, cr, path, text);
+        mapbox_add_text (data, path, text);
     }
 
-    cairo_path_destroy (path);
+    mapbox_feature_path_release (data, path);
   }
+}
 
+static void
+mapbox_feature_data_free (MapboxFeatureData *data)
+{
   vtile_mapcss_style_free (data->style);
-  g_hash_table_destroy (data->tags);
+  g_hash_table_unref (data->tags);
   g_free (data);
 }
 
@@ -1155,27 +1871,46 @@ mapbox_move_feature_if (GHashTable *tags,
   return tag_value && !g_strcmp0 (tag_value, value);
 }
 
-static void
-mapbox_process_feature (VTileMapbox *mapbox,
+/*
+ * Find the tags and style of a feature and the render layer it goes
+ * in. This only reads from the tile and the stylesheet, so it is safe
+ * to call for several features of the same render at once. The index
+ * is that of the feature in tile order.
+ */
+static MapboxFeatureData *
+mapbox_resolve_feature (VTileMapboxRenderContext *ctx,
                         VectorTile__Tile__Feature *feature,
                         VectorTile__Tile__Layer *layer,
                         char *primary_tag,
-                        guint layer_index)
+                        guint layer_index,
+                        guint index,
+                        guint *render_layer)
 {
   MapboxFeatureData *data;
+  MapboxSharedFeature *shared = NULL;
   GHashTable *tags;
 
-  tags = mapbox_get_tags (feature, layer, primary_tag);
+  if (ctx->shared_features) {
+    shared = &ctx->shared_features[index];
+    if (!shared->tags)
+      shared->tags = mapbox_get_tags (feature, layer, primary_tag);
+    tags = g_hash_table_ref (shared->tags);
+  } else {
+    tags = mapbox_get_tags (feature, layer, primary_tag);
+  }
 
   data = g_new (MapboxFeatureData, 1);
-  data->style = mapbox_feature_get_style (mapbox, tags, feature, layer);
+  data->style = mapbox_feature_get_style (ctx, tags, feature, layer);
   data->z_index = vtile_mapcss_style_get_num (data->style, "z-index");
   data->layer_index = layer_index;
   data->extent = layer->extent;
-  data->tile_size = mapbox->priv->tile_size;
+  data->tile_size = ctx->tile_size;
   data->feature = feature;
   data->tags = tags;
-  data->mapbox = mapbox;
+  data->ctx = ctx;
+  data->shared = shared;
+  data->render_layer = NULL;
+  data->has_bounds = FALSE;
 
   if (layer_index == MAPBOX_RENDER_LAYER_ROADS) {
     if (mapbox_move_feature_if (tags, "is_tunnel", "yes"))
@@ -1191,26 +1926,53 @@ mapbox_process_feature (VTileMapbox *mapbox,
       layer_index = MAPBOX_RENDER_LAYER_LANDUSE_NATURE;
   }
 
-  if (vtile_mapcss_style_get_num (data->style, "casing-width") > 0) {
-    mapbox->priv->render_layers[layer_index]->casings =
-      g_list_prepend (mapbox->priv->render_layers[layer_index]->casings, data);
-  }
+  *render_layer = layer_index;
+
+  return data;
+}
+
+/* Queue a resolved feature on its render layer */
+static void
+mapbox_queue_feature (VTileMapboxRenderContext *ctx,
+                      MapboxFeatureData *data,
+                      guint render_layer)
+{
+  MapboxRenderLayer *layer = &ctx->render_layers[render_layer];
+
+  data->render_layer = layer;
+  if (vtile_mapcss_style_get_num (data->style, "casing-width") > 0)
+    layer->casings = g_list_prepend (layer->casings, data);
+
+  layer->strokes = g_list_prepend (layer->strokes, data);
+}
+
+static void
+mapbox_process_feature (VTileMapboxRenderContext *ctx,
+                        VectorTile__Tile__Feature *feature,
+                        VectorTile__Tile__Layer *layer,
+                        char *primary_tag,
+                        guint layer_index,
+                        guint index)
+{
+  MapboxFeatureData *data;
+  guint render_layer;
 
-  mapbox->priv->render_layers[layer_index]->strokes =
-    g_list_prepend (mapbox->priv->render_layers[layer_index]->strokes, data);
+  data = mapbox_resolve_feature (ctx, feature, layer, primary_tag,
+                                 layer_index, index, &render_layer);
+  mapbox_queue_feature (ctx, data, render_layer);
 }
 
 static void
-mapbox_set_canvas_style (VTileMapbox *mapbox,
+mapbox_set_canvas_style (VTileMapboxRenderContext *ctx,
                          cairo_t *cr)
 {
   VTileMapCSSStyle *style;
   VTileMapCSSColor *color;
   gdouble opacity;
 
-  style = vtile_mapcss_get_style (mapbox->priv->stylesheet,
+  style = vtile_mapcss_get_style (ctx->stylesheet,
                                   VTILE_MAPCSS_SELECTOR_TYPE_CANVAS,
-                                  NULL, mapbox->priv->zoom_level);
+                                  NULL, ctx->zoom_level);
 
   opacity = vtile_mapcss_style_get_num (style, "fill-opacity");
   color = vtile_mapcss_style_get_color (style, "fill-color");
@@ -1221,9 +1983,7 @@ mapbox_set_canvas_style (VTileMapbox *mapbox,
                          opacity);
   vtile_mapcss_style_free (style);
 
-  cairo_rectangle (cr, 0, 0,
-                   mapbox->priv->tile_size,
-                   mapbox->priv->tile_size);
+  cairo_rectangle (cr, 0, 0, ctx->tile_size, ctx->tile_size);
   cairo_fill (cr);
 }
 
@@ -1268,63 +2028,2027 @@ mapbox_compare_z_index (const MapboxFeatureData *a,
   return 0;
 }
 
-static void
-mapbox_render_layer (VTileMapbox *mapbox,
-                     guint layer_index,
-                     cairo_t *cr)
+/*
+ * Returns TRUE once the render has been cancelled or has run past its
+ * deadline. Called between features and layers, also from workers.
+ */
+static gboolean
+mapbox_render_should_stop (VTileMapboxRenderContext *ctx)
 {
-  MapboxRenderLayer *layer = mapbox->priv->render_layers[layer_index];
+  if (g_atomic_int_get (&ctx->stopped))
+    return TRUE;
 
-  if (!layer->strokes)
-      return;
+  if (g_cancellable_is_cancelled (ctx->cancellable) ||
+      (ctx->deadline && g_get_monotonic_time () >= ctx->deadline)) {
+    g_atomic_int_set (&ctx->stopped, TRUE);
+    return TRUE;
+  }
 
-    if (layer->casings) {
-      layer->casings = g_list_sort (layer->casings,
-                                    (GCompareFunc) mapbox_compare_z_index);
+  return FALSE;
+}
 
-      g_list_foreach (layer->casings, (GFunc) mapbox_render_casings, cr);
-      g_list_free (layer->casings);
-      mapbox->priv->render_layers[layer_index]->casings = NULL;
-    }
+/*
+ * Returns TRUE once a degraded render has used up its time budget, the
+ * optional layer being drawn, or whose labels are being drawn, is then
+ * left incomplete.
+ */
+static gboolean
+mapbox_render_out_of_budget (VTileMapboxRenderContext *ctx)
+{
+  if (!ctx->budget_end)
+    return FALSE;
 
-    layer->strokes = g_list_sort (layer->strokes,
-                                  (GCompareFunc) mapbox_compare_z_index);
+  if (!ctx->out_of_budget && g_get_monotonic_time () >= ctx->budget_end)
+    ctx->out_of_budget = TRUE;
 
-    g_list_foreach (layer->strokes, (GFunc) mapbox_render_feature, cr);
-    g_list_free (layer->strokes);
-    mapbox->priv->render_layers[layer_index]->strokes = NULL;
+  return ctx->out_of_budget;
 }
 
-static gboolean
-mapbox_render_tile (VTileMapbox *mapbox,
-                    VectorTile__Tile *tile,
-                    cairo_t *cr)
+static void
+mapbox_render_set_stopped_error (VTileMapboxRenderContext *ctx,
+                                 GError **error)
+{
+  if (g_cancellable_set_error_if_cancelled (ctx->cancellable, error))
+    return;
 
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+               "Rendering did not finish before the deadline.");
+}
+
+/* Free the features queued on a render layer */
+static void
+mapbox_render_layer_clear (MapboxRenderLayer *layer)
 {
-  gint l, f;
+  g_list_free (layer->casings);
+  layer->casings = NULL;
 
-  for (l = 0; l < tile->n_layers; l++) {
-    char *primary_tag;
-    guint layer_index;
-    VectorTile__Tile__Layer *layer = tile->layers[l];
-    cairo_t *layer_cr;
+  g_list_free_full (layer->strokes,
+                    (GDestroyNotify) mapbox_feature_data_free);
+  layer->strokes = NULL;
 
-    mapbox_get_layer_data (layer->name, &primary_tag, &layer_index);
+  g_list_free_full (layer->labels, (GDestroyNotify) mapbox_label_free);
+  layer->labels = NULL;
 
-    for (f = 0; f < layer->n_features; f++) {
-      VectorTile__Tile__Feature *feature = layer->features[f];
+  layer->damage.width = layer->damage.height = 0;
+}
 
-      mapbox_process_feature (mapbox, feature, layer,
-                              primary_tag, layer_index);
+/*
+ * Hand the labels of a rendered layer over to the context. Layers are
+ * collected in render order, whichever thread rendered them.
+ */
+static void
+mapbox_render_layer_take_labels (VTileMapboxRenderContext *ctx,
+                                 guint layer_index)
+{
+  MapboxRenderLayer *layer = &ctx->render_layers[layer_index];
+  GList *l;
+
+  for (l = layer->labels; l; l = l->next)
+    ((MapboxLabel *) l->data)->layer_index = layer_index;
+
+  ctx->labels = g_list_concat (layer->labels, ctx->labels);
+  layer->labels = NULL;
+}
+
+/* Tell the layer done function that a layer is on the target */
+static void
+mapbox_render_layer_done (VTileMapboxRenderContext *ctx,
+                          guint layer_index)
+{
+  MapboxRenderLayer *layer = &ctx->render_layers[layer_index];
+
+  if (layer->damage.width == 0)
+    return;
+
+  if (ctx->layer_done)
+    ctx->layer_done (ctx, 1 << layer_index, &layer->damage,
+                     ctx->layer_done_data);
+  layer->damage.width = layer->damage.height = 0;
+}
+
+/* Returns FALSE if the render was stopped before the layer was done */
+static gboolean
+mapbox_render_layer (VTileMapboxRenderContext *ctx,
+                     guint layer_index,
+                     cairo_t *cr)
+{
+  MapboxRenderLayer *layer = &ctx->render_layers[layer_index];
+  gboolean draft = (ctx->flags & VTILE_MAPBOX_RENDER_DRAFT) != 0;
+  gboolean stopped = FALSE;
+  GList *l;
+
+  if (!layer->strokes)
+    return !mapbox_render_should_stop (ctx);
+
+  if (draft) {
+    cairo_save (cr);
+    cairo_set_antialias (cr, CAIRO_ANTIALIAS_NONE);
+  }
+
+  if (layer->casings && !draft) {
+    layer->casings = g_list_sort (layer->casings,
+                                  (GCompareFunc) mapbox_compare_z_index);
+
+    for (l = layer->casings; l != NULL && !stopped; l = l->next) {
+      stopped = mapbox_render_should_stop (ctx);
+      if (!stopped && !mapbox_render_out_of_budget (ctx))
+        mapbox_render_casings (l->data, cr);
+    }
+  }
+
+  layer->strokes = g_list_sort (layer->strokes,
+                                (GCompareFunc) mapbox_compare_z_index);
+
+  for (l = layer->strokes; l != NULL && !stopped; l = l->next) {
+    stopped = mapbox_render_should_stop (ctx);
+    if (!stopped && !mapbox_render_out_of_budget (ctx))
+      mapbox_render_feature (l->data, cr);
+  }
+
+  if (draft)
+    cairo_restore (cr);
+
+  g_list_free (layer->casings);
+  layer->casings = NULL;
+  g_list_free_full (layer->strokes,
+                    (GDestroyNotify) mapbox_feature_data_free);
+  layer->strokes = NULL;
+
+  return !stopped;
+}
+
+/* Render one layer into its own surface, run on a worker thread */
+static void
+mapbox_render_layer_job (guint job,
+                         MapboxLayerBatch *batch)
+{
+  guint layer_index = batch->layers[job];
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        batch->width, batch->height);
+  cairo_surface_set_device_offset (surface,
+                                   batch->x_offset, batch->y_offset);
+
+  cr = cairo_create (surface);
+  cairo_set_matrix (cr, &batch->matrix);
+  cairo_set_antialias (cr, batch->antialias);
+  cairo_set_tolerance (cr, batch->tolerance);
+  cairo_set_font_options (cr, batch->font_options);
+  mapbox_render_layer (batch->ctx, layer_index, cr);
+  cairo_destroy (cr);
+
+  batch->surfaces[job] = surface;
+}
+
+/*
+ * Render every non-empty layer into a surface of the same size and
+ * device offset as the target on its own thread, then composite them
+ * in layer order. The layers see the same transformation, antialiasing,
+ * tolerance and font options as @cr, so their pixels line up with what
+ * the serial path draws.
+ */
+static gboolean
+mapbox_render_layers_parallel (VTileMapboxRenderContext *ctx,
+                               cairo_t *cr)
+{
+  MapboxLayerBatch batch;
+  cairo_surface_t *target;
+  guint n_layers = 0;
+  guint i;
+
+  target = cairo_get_target (cr);
+
+  for (i = 0; i < NUM_RENDER_LAYERS; i++) {
+    if (ctx->render_layers[i].strokes)
+      batch.layers[n_layers++] = i;
+  }
+
+  batch.ctx = ctx;
+  batch.width = cairo_image_surface_get_width (target);
+  batch.height = cairo_image_surface_get_height (target);
+  cairo_surface_get_device_offset (target, &batch.x_offset, &batch.y_offset);
+  cairo_get_matrix (cr, &batch.matrix);
+  batch.antialias = cairo_get_antialias (cr);
+  batch.tolerance = cairo_get_tolerance (cr);
+  batch.font_options = cairo_font_options_create ();
+  cairo_get_font_options (cr, batch.font_options);
+
+  vtile_worker_pool_run (n_layers, (VTileWorkerFunc) mapbox_render_layer_job,
+                         &batch);
+  cairo_font_options_destroy (batch.font_options);
+
+  /* Half drawn layers of a stopped render are not composited */
+  if (mapbox_render_should_stop (ctx)) {
+    for (i = 0; i < n_layers; i++)
+      cairo_surface_destroy (batch.surfaces[i]);
+
+    return FALSE;
+  }
+
+  cairo_save (cr);
+  cairo_identity_matrix (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+  for (i = 0; i < n_layers; i++) {
+    cairo_set_source_surface (cr, batch.surfaces[i], 0, 0);
+    cairo_paint (cr);
+    cairo_surface_destroy (batch.surfaces[i]);
+
+    mapbox_render_layer_take_labels (ctx, batch.layers[i]);
+    mapbox_render_layer_done (ctx, batch.layers[i]);
+  }
+  cairo_restore (cr);
+
+  return TRUE;
+}
+
+/*
+ * Render the base layers first and the optional ones only while the
+ * time budget lasts. Base layers above an optional layer are drawn into
+ * groups that are painted once the optional layers below them have been
+ * drawn or skipped, so the layers still stack in render order.
+ */
+static gboolean
+mapbox_render_layers_degraded (VTileMapboxRenderContext *ctx,
+                               cairo_t *cr)
+{
+  cairo_pattern_t *groups[NUM_RENDER_LAYERS] = { NULL, };
+  gboolean deferred = FALSE;
+  gboolean done = TRUE;
+  guint l;
+
+  for (l = 0; l < NUM_RENDER_LAYERS && done; l++) {
+    if (!ctx->render_layers[l].strokes)
+      continue;
+
+    if (MAPBOX_OPTIONAL_LAYERS & (1 << l)) {
+      deferred = TRUE;
+    } else if (deferred) {
+      cairo_push_group (cr);
+      done = mapbox_render_layer (ctx, l, cr);
+      groups[l] = cairo_pop_group (cr);
+    } else {
+      done = mapbox_render_layer (ctx, l, cr);
+    }
+  }
+
+  ctx->budget_end = ctx->budget_start + ctx->budget;
+  for (l = 0; l < NUM_RENDER_LAYERS && done; l++) {
+    MapboxRenderLayer *layer = &ctx->render_layers[l];
+
+    if (groups[l]) {
+      cairo_save (cr);
+      cairo_set_source (cr, groups[l]);
+      cairo_paint (cr);
+      cairo_restore (cr);
+    } else if (layer->strokes) {
+      if (mapbox_render_out_of_budget (ctx)) {
+        mapbox_render_layer_clear (layer);
+        ctx->skipped_layers |= 1 << l;
+      } else {
+        done = mapbox_render_layer (ctx, l, cr);
+        if (mapbox_render_out_of_budget (ctx))
+          ctx->skipped_layers |= 1 << l;
+      }
+    }
+
+    mapbox_render_layer_take_labels (ctx, l);
+    if (done)
+      mapbox_render_layer_done (ctx, l);
+  }
+
+  /* The budget window stays open for the label phase */
+
+  for (l = 0; l < NUM_RENDER_LAYERS; l++) {
+    if (groups[l])
+      cairo_pattern_destroy (groups[l]);
+  }
+
+  return done;
+}
+
+/* Resolve one chunk of features, run on a worker thread */
+static void
+mapbox_resolve_chunk (guint chunk,
+                      MapboxFeatureBatch *batch)
+{
+  guint start = chunk * batch->chunk_size;
+  guint end = MIN (start + batch->chunk_size, batch->n_jobs);
+  guint i;
+
+  for (i = start; i < end; i++) {
+    MapboxFeatureJob *job = &batch->jobs[i];
+
+    if (mapbox_render_should_stop (batch->ctx)) {
+      job->data = NULL;
+      continue;
+    }
+
+    job->data = mapbox_resolve_feature (batch->ctx, job->feature, job->layer,
+                                        job->primary_tag, job->layer_index,
+                                        i, &job->render_layer);
+  }
+}
+
+/*
+ * Set how many features a tile needs for its styles to be resolved in
+ * parallel, and the least number of features handed out at once. Only
+ * meant for tests, before any render has started; 0 restores a default.
+ */
+void
+vtile_mapbox_set_parallel_limits (guint min_features,
+                                  guint chunk_size)
+{
+  mapbox_parallel_min_features = min_features > 0 ?
+    min_features : MAPBOX_PARALLEL_MIN_FEATURES;
+  mapbox_parallel_chunk_size = chunk_size > 0 ?
+    chunk_size : MAPBOX_PARALLEL_CHUNK_SIZE;
+}
+
+/*
+ * The first pass for large tiles. Every chunk of features is resolved
+ * on its own thread into its own slots, the features are then queued
+ * in tile order on the calling thread. The render layers end up exactly
+ * as with mapbox_process_feature(), so the output does not change.
+ * Returns FALSE if the render was stopped meanwhile.
+ */
+static gboolean
+mapbox_process_features_parallel (VTileMapboxRenderContext *ctx,
+                                  guint n_features)
+{
+  VectorTile__Tile *tile = ctx->tile->tile;
+  MapboxFeatureBatch batch;
+  guint n_chunks;
+  guint i = 0;
+  gint l, f;
+
+  batch.ctx = ctx;
+  batch.n_jobs = n_features;
+  batch.jobs = g_new (MapboxFeatureJob, n_features);
+
+  for (l = 0; l < tile->n_layers; l++) {
+    char *primary_tag;
+    guint layer_index;
+    VectorTile__Tile__Layer *layer = tile->layers[l];
+
+    mapbox_get_layer_data (layer->name, &primary_tag, &layer_index);
+
+    for (f = 0; f < layer->n_features; f++) {
+      batch.jobs[i].feature = layer->features[f];
+      batch.jobs[i].layer = layer;
+      batch.jobs[i].primary_tag = primary_tag;
+      batch.jobs[i].layer_index = layer_index;
+      i++;
+    }
+  }
+
+  /* A few chunks per thread evens out features of uneven cost */
+  n_chunks = (vtile_worker_pool_get_n_workers () + 1) * 4;
+  batch.chunk_size = MAX ((n_features + n_chunks - 1) / n_chunks,
+                          mapbox_parallel_chunk_size);
+  n_chunks = (n_features + batch.chunk_size - 1) / batch.chunk_size;
+
+  vtile_worker_pool_run (n_chunks, (VTileWorkerFunc) mapbox_resolve_chunk,
+                         &batch);
+
+  /* Queued features are freed with the render layers if we stopped */
+  for (i = 0; i < n_features; i++) {
+    if (batch.jobs[i].data)
+      mapbox_queue_feature (ctx, batch.jobs[i].data,
+                            batch.jobs[i].render_layer);
+  }
+
+  g_free (batch.jobs);
+
+  return !mapbox_render_should_stop (ctx);
+}
+
+/* Process all features of the tile, in tile order */
+static gboolean
+mapbox_process_features (VTileMapboxRenderContext *ctx)
+{
+  VectorTile__Tile *tile = ctx->tile->tile;
+  guint index = 0;
+  gint l, f;
+
+  for (l = 0; l < tile->n_layers; l++) {
+    char *primary_tag;
+    guint layer_index;
+    VectorTile__Tile__Layer *layer = tile->layers[l];
+
+    mapbox_get_layer_data (layer->name, &primary_tag, &layer_index);
+
+    for (f = 0; f < layer->n_features; f++) {
+      VectorTile__Tile__Feature *feature = layer->features[f];
+
+      if (mapbox_render_should_stop (ctx))
+        return FALSE;
+
+      mapbox_process_feature (ctx, feature, layer,
+                              primary_tag, layer_index, index++);
     }
   }
 
-  for (l = 0; l < NUM_RENDER_LAYERS; l++)
-    mapbox_render_layer (mapbox, l, cr);
+  return TRUE;
+}
+
+/* Labels with a higher z-index, then larger features, are placed first */
+static gint
+mapbox_label_compare (gconstpointer data_a,
+                      gconstpointer data_b)
+{
+  const MapboxLabel *a = data_a;
+  const MapboxLabel *b = data_b;
+
+  if (a->z_index != b->z_index)
+    return a->z_index > b->z_index ? -1 : 1;
+  if (a->size != b->size)
+    return a->size > b->size ? -1 : 1;
+
+  return 0;
+}
+
+/* Returns TRUE if all of @label is on the tile */
+static gboolean
+mapbox_label_is_inside (VTileMapboxRenderContext *ctx,
+                        MapboxLabel *label)
+{
+  gint i;
+
+  for (i = 0; i < 4; i++) {
+    if (label->box.x[i] < 0 || label->box.x[i] > ctx->tile_size ||
+        label->box.y[i] < 0 || label->box.y[i] > ctx->tile_size)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Drop the labels that collide with more important ones. Labels are
+ * placed in priority order on a grid of the boxes already placed, line
+ * labels with their rotated boxes. Labels of features another tile
+ * shows the label of are left out too.
+ */
+static void
+mapbox_place_labels (VTileMapboxRenderContext *ctx)
+{
+  VTileLabelGrid *grid;
+  GList *sorted;
+  GList *l;
+
+  grid = vtile_label_grid_new (ctx->tile_size, ctx->tile_size,
+                               MAPBOX_LABEL_GRID_CELL_SIZE);
+
+  /* g_list_sort() is stable, equal labels keep their render order */
+  sorted = g_list_sort (g_list_copy (ctx->labels), mapbox_label_compare);
+  for (l = sorted; l; l = l->next) {
+    MapboxLabel *label = l->data;
+
+    label->placed = FALSE;
+    if (vtile_label_grid_collides (grid, &label->box))
+      continue;
+
+    if (ctx->label_registry && label->uid &&
+        !vtile_mapbox_label_registry_claim (ctx->label_registry,
+                                            ctx->zoom_level,
+                                            ctx->tile_x, ctx->tile_y,
+                                            label->uid, label->key.text,
+                                            mapbox_label_is_inside (ctx,
+                                                                    label)))
+      continue;
+
+    label->placed = vtile_label_grid_insert (grid, &label->box);
+  }
+
+  g_list_free (sorted);
+  vtile_label_grid_free (grid);
+}
+
+/* Keep what it takes to draw @label when it is asked for */
+static VTileMapboxLazyLabel *
+mapbox_lazy_label_new (VTileMapboxRenderContext *ctx,
+                       MapboxLabel *label)
+{
+  VTileMapboxLazyLabel *lazy;
+
+  lazy = g_new0 (VTileMapboxLazyLabel, 1);
+  lazy->ref_count = 1;
+  lazy->key = label->key;
+  lazy->key.text = g_strdup (label->key.text);
+  lazy->key.font.family = g_strdup (label->key.font.family);
+  lazy->label = label->label;
+  lazy->matrix = label->matrix;
+  if (ctx->label_cache)
+    lazy->cache = vtile_mapbox_label_cache_ref (ctx->label_cache);
+
+  return lazy;
+}
+
+VTileMapboxLazyLabel *
+vtile_mapbox_lazy_label_ref (VTileMapboxLazyLabel *lazy)
+{
+  g_atomic_int_inc (&lazy->ref_count);
+
+  return lazy;
+}
+
+void
+vtile_mapbox_lazy_label_unref (VTileMapboxLazyLabel *lazy)
+{
+  if (!g_atomic_int_dec_and_test (&lazy->ref_count))
+    return;
+
+  g_free ((char *) lazy->key.text);
+  g_free ((char *) lazy->key.font.family);
+  if (lazy->cache)
+    vtile_mapbox_label_cache_unref (lazy->cache);
+  g_free (lazy);
+}
+
+/**
+ * vtile_mapbox_text_get_surface:
+ * @text: a #VTileMapboxText.
+ *
+ * Returns the surface of @text, drawing the label first if it was
+ * rendered with %VTILE_MAPBOX_RENDER_LAZY_LABELS. A label can be drawn
+ * from any thread, but a single @text from only one at a time.
+ *
+ * Returns: (transfer none): the surface of @text.
+ */
+cairo_surface_t *
+vtile_mapbox_text_get_surface (VTileMapboxText *text)
+{
+  VTileMapboxLazyLabel *lazy;
+  VTileMapboxLabel label;
+
+  g_return_val_if_fail (text != NULL, NULL);
+
+  if (text->surface || !text->lazy)
+    return text->surface;
+
+  lazy = text->lazy;
+  label = lazy->label;
+  mapbox_get_label_surface (lazy->cache, &lazy->key, &lazy->matrix, &label);
+
+  text->surface = label.surface;
+
+  return text->surface;
+}
+
+static void
+mapbox_text_rasterize_job (guint job,
+                           gpointer user_data)
+{
+  GPtrArray *texts = user_data;
+
+  vtile_mapbox_text_get_surface (g_ptr_array_index (texts, job));
+}
+
+/**
+ * vtile_mapbox_texts_rasterize:
+ * @texts: (element-type VTileMapboxText): a list of #VTileMapboxText.
+ *
+ * Draw all labels of @texts that have no surface yet, spread over
+ * several threads. Call this for the labels that are about to be
+ * shown rather than vtile_mapbox_text_get_surface() one by one.
+ */
+void
+vtile_mapbox_texts_rasterize (GList *texts)
+{
+  GPtrArray *pending;
+  GList *l;
+
+  pending = g_ptr_array_new ();
+  for (l = texts; l; l = l->next) {
+    VTileMapboxText *text = l->data;
+
+    if (!text->surface && text->lazy)
+      g_ptr_array_add (pending, text);
+  }
+
+  if (pending->len > 0)
+    vtile_worker_pool_run (pending->len, mapbox_text_rasterize_job, pending);
+
+  g_ptr_array_free (pending, TRUE);
+}
+
+/* Tall labels are packed first */
+static gint
+mapbox_label_compare_height (gconstpointer data_a,
+                             gconstpointer data_b)
+{
+  const MapboxLabel *a = data_a;
+  const MapboxLabel *b = data_b;
+
+  return b->label.height - a->label.height;
+}
+
+/*
+ * Copy the drawn labels onto as few atlas surfaces as possible. The
+ * texts then point into the atlases.
+ */
+static void
+mapbox_pack_labels (VTileMapboxRenderContext *ctx,
+                    GList *labels)
+{
+  VTileLabelAtlas *atlas;
+  cairo_t **page_cr;
+  guint n_pages;
+  GList *l;
+  guint i;
+
+  atlas = vtile_label_atlas_new (MAPBOX_LABEL_ATLAS_SIZE);
+
+  labels = g_list_sort (g_list_copy (labels), mapbox_label_compare_height);
+  for (l = labels; l; l = l->next) {
+    MapboxLabel *label = l->data;
+
+    label->atlas_page = vtile_label_atlas_add (atlas,
+                                               label->label.width,
+                                               label->label.height,
+                                               &label->atlas_x,
+                                               &label->atlas_y);
+  }
+
+  n_pages = vtile_label_atlas_get_n_pages (atlas);
+  page_cr = g_new (cairo_t *, n_pages);
+  for (i = 0; i < n_pages; i++) {
+    cairo_surface_t *surface;
+    gint width, height;
+
+    vtile_label_atlas_get_page_size (atlas, i, &width, &height);
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    page_cr[i] = cairo_create (surface);
+    ctx->atlases = g_list_prepend (ctx->atlases, surface);
+  }
+  ctx->atlases = g_list_reverse (ctx->atlases);
+
+  for (l = labels; l; l = l->next) {
+    MapboxLabel *label = l->data;
+    cairo_t *cr = page_cr[label->atlas_page];
+
+    cairo_set_source_surface (cr, label->label.surface,
+                              label->atlas_x, label->atlas_y);
+    cairo_paint (cr);
+  }
+
+  for (i = 0; i < n_pages; i++) {
+    cairo_surface_flush (cairo_get_target (page_cr[i]));
+    cairo_destroy (page_cr[i]);
+  }
+
+  g_free (page_cr);
+  g_list_free (labels);
+  vtile_label_atlas_free (atlas);
+}
+
+/*
+ * Lay out the labels and find their boxes, dropping the ones that do
+ * not fit along their lines. Returns FALSE if the render was stopped
+ * meanwhile.
+ */
+static gboolean
+mapbox_measure_labels (VTileMapboxRenderContext *ctx)
+{
+  GList *l = ctx->labels;
+
+  while (l) {
+    MapboxLabel *label = l->data;
+    GList *next = l->next;
+    PangoLayout *layout;
+    gint width, height;
+
+    if (mapbox_render_should_stop (ctx))
+      return FALSE;
+
+    layout = mapbox_get_text_layout (label->key.text, &label->key.font);
+    pango_layout_get_pixel_size (layout, &width, &height);
+
+    if (label->max_width && width > label->max_width) {
+      ctx->labels = g_list_delete_link (ctx->labels, l);
+      mapbox_label_free (label);
+    } else {
+      mapbox_measure_label (&label->key, width, height,
+                            &label->label, &label->matrix);
+      mapbox_label_set_box (label, width, height);
+    }
+
+    l = next;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Returns TRUE if @label belongs to an optional layer and the time
+ * budget is used up, the label is then left out and its layer reported
+ * as skipped.
+ */
+static gboolean
+mapbox_label_out_of_budget (VTileMapboxRenderContext *ctx,
+                            MapboxLabel *label)
+{
+  VTileMapboxLayerFlags layer = 1 << label->layer_index;
+
+  if (!(MAPBOX_OPTIONAL_LAYERS & layer) || !mapbox_render_out_of_budget (ctx))
+    return FALSE;
+
+  ctx->skipped_layers |= layer;
+
+  return TRUE;
+}
+
+/*
+ * The label phase of a render: turn the labels found while drawing the
+ * geometry into the texts handed out, drawing only the ones that were
+ * placed. Labels of optional layers are only drawn while the time
+ * budget lasts. Returns FALSE if the render was stopped meanwhile.
+ */
+static gboolean
+mapbox_finish_labels (VTileMapboxRenderContext *ctx)
+{
+  GList *placed = NULL;
+  GList *l;
+
+  if (!mapbox_measure_labels (ctx))
+    return FALSE;
+
+  if (ctx->flags & VTILE_MAPBOX_RENDER_PLACE_LABELS) {
+    mapbox_place_labels (ctx);
+  } else {
+    for (l = ctx->labels; l; l = l->next)
+      ((MapboxLabel *) l->data)->placed = TRUE;
+  }
+
+  for (l = ctx->labels; l; l = l->next) {
+    MapboxLabel *label = l->data;
+
+    if (!label->placed)
+      continue;
+
+    if (mapbox_render_should_stop (ctx)) {
+      g_list_free (placed);
+      return FALSE;
+    }
+
+    /* Lazy labels are drawn when asked for, outside of the render */
+    if (ctx->flags & VTILE_MAPBOX_RENDER_LAZY_LABELS) {
+      placed = g_list_prepend (placed, label);
+      continue;
+    }
+
+    if (mapbox_label_out_of_budget (ctx, label))
+      continue;
+
+    placed = g_list_prepend (placed, label);
+    mapbox_get_label_surface (ctx->label_cache, &label->key,
+                              &label->matrix, &label->label);
+  }
+  placed = g_list_reverse (placed);
+
+  if (ctx->flags & VTILE_MAPBOX_RENDER_LABEL_ATLAS &&
+      !(ctx->flags & VTILE_MAPBOX_RENDER_LAZY_LABELS))
+    mapbox_pack_labels (ctx, placed);
+
+  for (l = placed; l; l = l->next) {
+    MapboxLabel *label = l->data;
+    VTileMapboxText *m_text;
+
+    m_text = g_new0 (VTileMapboxText, 1);
+    m_text->offset_x = label->x - label->label.anchor_x;
+    m_text->offset_y = label->y - label->label.anchor_y;
+    m_text->width = label->label.width;
+    m_text->height = label->label.height;
+    m_text->uid = g_strdup (label->uid);
+    m_text->text = g_strdup (label->key.text);
+    m_text->angle = label->key.angle * MAPBOX_LABEL_ANGLE_STEP;
+
+    /* Labels of a plan can be drawn again at other scales */
+    if (ctx->flags & VTILE_MAPBOX_RENDER_LAZY_LABELS || ctx->plan)
+      m_text->lazy = mapbox_lazy_label_new (ctx, label);
+
+    if (ctx->flags & VTILE_MAPBOX_RENDER_LAZY_LABELS) {
+      /* Drawn when they are asked for */
+    } else if (ctx->flags & VTILE_MAPBOX_RENDER_LABEL_ATLAS) {
+      m_text->surface = g_list_nth_data (ctx->atlases, label->atlas_page);
+      m_text->atlas_x = label->atlas_x;
+      m_text->atlas_y = label->atlas_y;
+      cairo_surface_reference (m_text->surface);
+    } else {
+      m_text->surface = cairo_surface_reference (label->label.surface);
+    }
+
+    ctx->texts = g_list_prepend (ctx->texts, m_text);
+  }
+
+  ctx->texts = g_list_reverse (ctx->texts);
+  g_list_free (placed);
+  g_list_free_full (ctx->labels, (GDestroyNotify) mapbox_label_free);
+  ctx->labels = NULL;
+
+  return TRUE;
+}
+
+/*
+ * The geometry phase of a render: resolve the features and draw the
+ * layers, collecting the labels. Returns FALSE if the render was
+ * stopped.
+ */
+static gboolean
+mapbox_render_tile_geometry (VTileMapboxRenderContext *ctx,
+                             cairo_t *cr)
+{
+  VectorTile__Tile *tile = ctx->tile->tile;
+  cairo_surface_t *target = cairo_get_target (cr);
+  guint n_features = 0;
+  gboolean done = TRUE;
+  gint l;
+
+  for (l = 0; l < tile->n_layers; l++)
+    n_features += tile->layers[l]->n_features;
+
+  if (ctx->flags & VTILE_MAPBOX_RENDER_PARALLEL_STYLE &&
+      n_features >= mapbox_parallel_min_features &&
+      vtile_worker_pool_get_n_workers () > 0)
+    done = mapbox_process_features_parallel (ctx, n_features);
+  else
+    done = mapbox_process_features (ctx);
+
+  if (!done) {
+    /* Nothing has been drawn yet */
+  } else if (ctx->budget > 0 && !ctx->plan) {
+    done = mapbox_render_layers_degraded (ctx, cr);
+  } else if (ctx->flags & VTILE_MAPBOX_RENDER_PARALLEL_LAYERS &&
+             !ctx->plan &&
+             vtile_worker_pool_get_n_workers () > 0 &&
+             cairo_surface_get_type (target) == CAIRO_SURFACE_TYPE_IMAGE) {
+    done = mapbox_render_layers_parallel (ctx, cr);
+  } else {
+    for (l = 0; l < NUM_RENDER_LAYERS && done; l++) {
+      done = mapbox_render_layer (ctx, l, cr);
+      mapbox_render_layer_take_labels (ctx, l);
+      if (done)
+        mapbox_render_layer_done (ctx, l);
+    }
+  }
+
+  return done;
+}
+
+/* Drop what a stopped render left behind and tell why it stopped */
+static void
+mapbox_render_fail (VTileMapboxRenderContext *ctx,
+                    GError **error)
+{
+  gint l;
+
+  for (l = 0; l < NUM_RENDER_LAYERS; l++)
+    mapbox_render_layer_clear (&ctx->render_layers[l]);
+
+  g_list_free_full (ctx->labels, (GDestroyNotify) mapbox_label_free);
+  ctx->labels = NULL;
+  g_list_free_full (ctx->texts, (GDestroyNotify) vtile_mapbox_text_free);
+  ctx->texts = NULL;
+  g_list_free_full (ctx->atlases, (GDestroyNotify) cairo_surface_destroy);
+  ctx->atlases = NULL;
+
+  mapbox_render_set_stopped_error (ctx, error);
+}
+
+static void
+mapbox_render_reset (VTileMapboxRenderContext *ctx)
+{
+  g_list_free_full (ctx->texts, (GDestroyNotify) vtile_mapbox_text_free);
+  ctx->texts = NULL;
+  g_list_free_full (ctx->atlases, (GDestroyNotify) cairo_surface_destroy);
+  ctx->atlases = NULL;
+  ctx->stopped = FALSE;
+  ctx->out_of_budget = FALSE;
+  ctx->skipped_layers = 0;
+  ctx->budget_start = g_get_monotonic_time ();
+  ctx->budget_end = 0;
+}
+
+static gboolean
+mapbox_render_tile (VTileMapboxRenderContext *ctx,
+                    cairo_t *cr,
+                    GError **error)
+
+{
+  if (!mapbox_render_tile_geometry (ctx, cr) || !mapbox_finish_labels (ctx)) {
+    mapbox_render_fail (ctx, error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * vtile_mapbox_render_context_new:
+ * @tile: a decoded #VTileMapboxTile.
+ * @stylesheet: the #VTileMapCSS to render with.
+ * @tile_size: the size (width/height) to render the tile at.
+ * @zoom_level: the zoom level of the tile.
+ *
+ * Create the state for rendering @tile. A render context is cheap and
+ * meant to be used for a single render; any number of contexts can
+ * render the same @tile at the same time from different threads.
+ * A single context must not be used from several threads at once.
+ *
+ * Returns: a new #VTileMapboxRenderContext, use
+ * vtile_mapbox_render_context_unref() when done.
+ */
+VTileMapboxRenderContext *
+vtile_mapbox_render_context_new (VTileMapboxTile *tile,
+                                 VTileMapCSS *stylesheet,
+                                 guint tile_size,
+                                 guint zoom_level)
+{
+  VTileMapboxRenderContext *ctx;
+
+  g_return_val_if_fail (tile != NULL, NULL);
+  g_return_val_if_fail (stylesheet != NULL, NULL);
+
+  ctx = g_new0 (VTileMapboxRenderContext, 1);
+  ctx->ref_count = 1;
+  ctx->tile = vtile_mapbox_tile_ref (tile);
+  ctx->stylesheet = g_object_ref (stylesheet);
+  ctx->tile_size = tile_size;
+  ctx->zoom_level = zoom_level;
+  ctx->flags = VTILE_MAPBOX_RENDER_PARALLEL_STYLE |
+               VTILE_MAPBOX_RENDER_PLACE_LABELS;
+  ctx->label_cache =
+    vtile_mapbox_label_cache_ref (vtile_mapbox_label_cache_get_default ());
+
+  return ctx;
+}
+
+/**
+ * vtile_mapbox_render_context_get_tile_size:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns: the size (width/height) @ctx renders the tile at.
+ */
+guint
+vtile_mapbox_render_context_get_tile_size (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, 0);
+
+  return ctx->tile_size;
+}
+
+/**
+ * vtile_mapbox_render_context_set_flags:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @flags: the #VTileMapboxRenderFlags to render with.
+ *
+ * Choose how @ctx renders. The default is
+ * %VTILE_MAPBOX_RENDER_PARALLEL_STYLE | %VTILE_MAPBOX_RENDER_PLACE_LABELS.
+ */
+void
+vtile_mapbox_render_context_set_flags (VTileMapboxRenderContext *ctx,
+                                       VTileMapboxRenderFlags flags)
+{
+  g_return_if_fail (ctx != NULL);
+
+  ctx->flags = flags;
+}
+
+/**
+ * vtile_mapbox_render_context_get_flags:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns: the #VTileMapboxRenderFlags of @ctx.
+ */
+VTileMapboxRenderFlags
+vtile_mapbox_render_context_get_flags (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, VTILE_MAPBOX_RENDER_DEFAULT);
+
+  return ctx->flags;
+}
+
+/**
+ * vtile_mapbox_render_context_set_cancellable:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ *
+ * Set a #GCancellable that stops renders of @ctx. Cancelling a running
+ * render makes it stop after the feature being drawn and fail with
+ * %G_IO_ERROR_CANCELLED.
+ */
+void
+vtile_mapbox_render_context_set_cancellable (VTileMapboxRenderContext *ctx,
+                                             GCancellable *cancellable)
+{
+  g_return_if_fail (ctx != NULL);
+
+  if (cancellable)
+    g_object_ref (cancellable);
+  if (ctx->cancellable)
+    g_object_unref (ctx->cancellable);
+
+  ctx->cancellable = cancellable;
+}
+
+/**
+ * vtile_mapbox_render_context_get_cancellable:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns: (transfer none) (nullable): the #GCancellable that stops
+ * renders of @ctx, or %NULL.
+ */
+GCancellable *
+vtile_mapbox_render_context_get_cancellable (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  return ctx->cancellable;
+}
+
+/**
+ * vtile_mapbox_render_context_set_deadline:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @deadline: the monotonic time, as from g_get_monotonic_time(), by
+ * which renders must be done, or 0 for no deadline.
+ *
+ * Renders of @ctx still running at @deadline stop after the feature
+ * being drawn and fail with %G_IO_ERROR_TIMED_OUT.
+ */
+void
+vtile_mapbox_render_context_set_deadline (VTileMapboxRenderContext *ctx,
+                                          gint64 deadline)
+{
+  g_return_if_fail (ctx != NULL);
+
+  ctx->deadline = deadline;
+}
+
+/**
+ * vtile_mapbox_render_context_set_time_budget:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @budget: the time budget in microseconds, or 0 to always draw all
+ * layers.
+ *
+ * With a time budget @ctx renders a degraded tile rather than a late
+ * one. The base layers, earth, landuse, water and roads, are drawn
+ * first. Places, buildings and points of interest, with their labels,
+ * are then drawn in render order while less than @budget has passed
+ * since the render started; the labels of places and points of interest
+ * are drawn after all layers and only while the budget lasts as well.
+ * Layers that did not fit, or whose labels did not, are reported by
+ * vtile_mapbox_render_context_get_skipped_layers(), so that the tile
+ * can be rendered again at full quality later.
+ *
+ * A degraded render draws the layers in sequence, the
+ * %VTILE_MAPBOX_RENDER_PARALLEL_LAYERS flag is not used. Unlike a
+ * deadline an exhausted budget is not an error.
+ */
+void
+vtile_mapbox_render_context_set_time_budget (VTileMapboxRenderContext *ctx,
+                                             gint64 budget)
+{
+  g_return_if_fail (ctx != NULL);
+
+  ctx->budget = budget;
+}
+
+/**
+ * vtile_mapbox_render_context_get_skipped_layers:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns the layers the last render of @ctx left out, or did not
+ * finish, because its time budget ran out.
+ *
+ * Returns: the skipped layers, 0 if the tile is complete.
+ */
+VTileMapboxLayerFlags
+vtile_mapbox_render_context_get_skipped_layers (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, 0);
+
+  return ctx->skipped_layers;
+}
+
+/**
+ * vtile_mapbox_render_context_set_label_cache:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cache: (nullable): a #VTileMapboxLabelCache, or %NULL.
+ *
+ * Set the cache @ctx looks up and keeps rendered labels in. By default
+ * the cache from vtile_mapbox_label_cache_get_default() is used, %NULL
+ * renders every label from scratch.
+ */
+void
+vtile_mapbox_render_context_set_label_cache (VTileMapboxRenderContext *ctx,
+                                             VTileMapboxLabelCache *cache)
+{
+  g_return_if_fail (ctx != NULL);
+
+  if (cache)
+    vtile_mapbox_label_cache_ref (cache);
+  if (ctx->label_cache)
+    vtile_mapbox_label_cache_unref (ctx->label_cache);
+
+  ctx->label_cache = cache;
+}
+
+/**
+ * vtile_mapbox_render_context_set_layer_done_func:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @layer_done: (scope notified) (nullable): the function to call, or
+ * %NULL.
+ * @user_data: data for @layer_done.
+ *
+ * Call @layer_done each time a layer of the tile has been drawn to the
+ * target, with the region of the tile the layer touched. A view can so
+ * show land and water while roads and buildings are still being drawn.
+ *
+ * @layer_done is called on the thread that renders. The target is not
+ * drawn to until it returns, so the damaged region can be copied out of
+ * it. Layers without features are left out, and a render that is
+ * stopped does not report the layer it stopped in.
+ */
+void
+vtile_mapbox_render_context_set_layer_done_func (VTileMapboxRenderContext *ctx,
+                                                 VTileMapboxLayerDoneFunc layer_done,
+                                                 gpointer user_data)
+{
+  g_return_if_fail (ctx != NULL);
+
+  ctx->layer_done = layer_done;
+  ctx->layer_done_data = user_data;
+}
+
+/**
+ * vtile_mapbox_render_context_set_label_registry:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @registry: (nullable): a #VTileMapboxLabelRegistry, or %NULL.
+ * @x: the x coordinate of the tile of @ctx.
+ * @y: the y coordinate of the tile of @ctx.
+ *
+ * Share the labels of @ctx with the other tiles rendered with
+ * @registry, a label of a feature is then only shown on one of them.
+ * The zoom level of @ctx and @x, @y tell the tiles apart.
+ */
+void
+vtile_mapbox_render_context_set_label_registry (VTileMapboxRenderContext *ctx,
+                                                VTileMapboxLabelRegistry *registry,
+                                                guint x,
+                                                guint y)
+{
+  g_return_if_fail (ctx != NULL);
+
+  if (registry)
+    vtile_mapbox_label_registry_ref (registry);
+  if (ctx->label_registry)
+    vtile_mapbox_label_registry_unref (ctx->label_registry);
+
+  ctx->label_registry = registry;
+  ctx->tile_x = x;
+  ctx->tile_y = y;
+}
+
+/**
+ * vtile_mapbox_render_context_ref:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns: @ctx
+ */
+VTileMapboxRenderContext *
+vtile_mapbox_render_context_ref (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  g_atomic_int_inc (&ctx->ref_count);
+
+  return ctx;
+}
+
+/**
+ * vtile_mapbox_render_context_unref:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Release a reference to @ctx, the context and the labels it holds are
+ * freed when the last reference is gone.
+ */
+void
+vtile_mapbox_render_context_unref (VTileMapboxRenderContext *ctx)
+{
+  gint i;
+
+  g_return_if_fail (ctx != NULL);
+
+  if (!g_atomic_int_dec_and_test (&ctx->ref_count))
+    return;
+
+  for (i = 0; i < NUM_RENDER_LAYERS; i++)
+    mapbox_render_layer_clear (&ctx->render_layers[i]);
+
+  g_list_free_full (ctx->labels, (GDestroyNotify) mapbox_label_free);
+  g_list_free_full (ctx->texts, (GDestroyNotify) vtile_mapbox_text_free);
+  g_list_free_full (ctx->atlases, (GDestroyNotify) cairo_surface_destroy);
+  vtile_mapbox_tile_unref (ctx->tile);
+  g_object_unref (ctx->stylesheet);
+  if (ctx->cancellable)
+    g_object_unref (ctx->cancellable);
+  if (ctx->label_cache)
+    vtile_mapbox_label_cache_unref (ctx->label_cache);
+  if (ctx->label_registry)
+    vtile_mapbox_label_registry_unref (ctx->label_registry);
+  g_free (ctx);
+}
+
+/**
+ * vtile_mapbox_render_context_render:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cr: the cairo context to render to.
+ * @error: a #GError, or %NULL.
+ *
+ * Render the tile of @ctx to @cr. Labels from a previous render with
+ * @ctx are dropped.
+ *
+ * A render that is cancelled or runs past its deadline stops between
+ * two features and fails with %G_IO_ERROR_CANCELLED or
+ * %G_IO_ERROR_TIMED_OUT. @cr is then left partly drawn and no labels
+ * are kept.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_context_render (VTileMapboxRenderContext *ctx,
+                                    cairo_t *cr,
+                                    GError **error)
+{
+  g_return_val_if_fail (ctx != NULL, FALSE);
+  g_return_val_if_fail (cr != NULL, FALSE);
+
+  mapbox_render_reset (ctx);
+
+  return mapbox_render_tile (ctx, cr, error);
+}
+
+/**
+ * vtile_mapbox_render_context_render_to_data:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @data: (array): the pixels to render to.
+ * @format: the pixel format of @data.
+ * @stride: the number of bytes between the rows of @data.
+ * @error: a #GError, or %NULL.
+ *
+ * Render the tile of @ctx straight into @data, which holds tile size
+ * rows of tile size pixels in @format, @stride bytes apart. The pixels
+ * are not copied or allocated, so a pool of buffers can be rendered to
+ * over and over again and handed to an encoder or compositor as is.
+ * @data is cleared before the tile is drawn.
+ *
+ * @stride must be a valid stride for @format, as from
+ * cairo_format_stride_for_width(), or the render fails with
+ * %G_IO_ERROR_INVALID_ARGUMENT.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_context_render_to_data (VTileMapboxRenderContext *ctx,
+                                            guchar *data,
+                                            cairo_format_t format,
+                                            gint stride,
+                                            GError **error)
+{
+  cairo_surface_t *surface;
+  cairo_status_t status;
+  cairo_t *cr;
+  gboolean rendered;
+
+  g_return_val_if_fail (ctx != NULL, FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+
+  surface = cairo_image_surface_create_for_data (data, format,
+                                                 ctx->tile_size,
+                                                 ctx->tile_size,
+                                                 stride);
+  status = cairo_surface_status (surface);
+  if (status != CAIRO_STATUS_SUCCESS) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "Cannot render to the buffer: %s",
+                 cairo_status_to_string (status));
+    cairo_surface_destroy (surface);
+    return FALSE;
+  }
+
+  cr = cairo_create (surface);
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+  mapbox_render_reset (ctx);
+  rendered = mapbox_render_tile (ctx, cr, error);
+
+  cairo_destroy (cr);
+  cairo_surface_finish (surface);
+  cairo_surface_destroy (surface);
+
+  return rendered;
+}
+
+/**
+ * vtile_mapbox_render_context_render_region:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cr: the cairo context to render to.
+ * @region: the region of the tile to render, in tile pixels.
+ * @error: a #GError, or %NULL.
+ *
+ * Render the part of the tile of @ctx inside @region to @cr, for
+ * instance to repaint below an overlay that moved or the strip of a
+ * tile scrolled into view. Only features that can reach into @region
+ * are drawn, the drawing is clipped to it and only the labels anchored
+ * inside @region are kept. Inside @region the tile looks as with
+ * vtile_mapbox_render_context_render(), the labels may differ as
+ * labels outside of it do not compete for their place.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_context_render_region (VTileMapboxRenderContext *ctx,
+                                           cairo_t *cr,
+                                           const cairo_rectangle_int_t *region,
+                                           GError **error)
+{
+  gboolean rendered;
+
+  g_return_val_if_fail (ctx != NULL, FALSE);
+  g_return_val_if_fail (cr != NULL, FALSE);
+  g_return_val_if_fail (region != NULL, FALSE);
+
+  mapbox_render_reset (ctx);
+  ctx->has_region = TRUE;
+  ctx->region = *region;
+
+  cairo_save (cr);
+  cairo_rectangle (cr, region->x, region->y, region->width, region->height);
+  cairo_clip (cr);
+  rendered = mapbox_render_tile (ctx, cr, error);
+  cairo_restore (cr);
+
+  ctx->has_region = FALSE;
+
+  return rendered;
+}
+
+/**
+ * vtile_mapbox_render_context_build_plan:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @error: a #GError, or %NULL.
+ *
+ * Do all of a render of @ctx but the drawing: resolve the styles of the
+ * features, sort them, decode their geometry and place and draw the
+ * labels. The outcome is kept in a #VTileMapboxRenderPlan, that draws
+ * the tile to any cairo context with vtile_mapbox_render_plan_render().
+ *
+ * The plan takes the texts and atlases of the render, they are not
+ * left on @ctx. A time budget is not used, the plan holds every layer.
+ * The render can be stopped as with vtile_mapbox_render_context_render().
+ *
+ * Returns: (transfer full): a new #VTileMapboxRenderPlan, or %NULL on
+ * error.
+ */
+VTileMapboxRenderPlan *
+vtile_mapbox_render_context_build_plan (VTileMapboxRenderContext *ctx,
+                                        GError **error)
+{
+  VTileMapboxRenderPlan *plan;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  gboolean done;
+
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  mapbox_render_reset (ctx);
+
+  /* The paths are decoded on a scratch context with no transformation */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+  cr = cairo_create (surface);
+
+  plan = vtile_mapbox_render_plan_new (ctx->tile_size);
+  ctx->plan = plan;
+  done = mapbox_render_tile_geometry (ctx, cr) && mapbox_finish_labels (ctx);
+  ctx->plan = NULL;
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  if (!done) {
+    mapbox_render_fail (ctx, error);
+    vtile_mapbox_render_plan_unref (plan);
+    return NULL;
+  }
+
+  vtile_mapbox_render_plan_seal (plan, ctx->texts, ctx->atlases);
+  ctx->texts = NULL;
+  ctx->atlases = NULL;
+
+  return plan;
+}
+
+/**
+ * vtile_mapbox_render_context_build_plans:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @stylesheets: (array length=n_stylesheets): the stylesheets to build
+ * plans for.
+ * @n_stylesheets: the number of stylesheets.
+ * @error: a #GError, or %NULL.
+ *
+ * Build a #VTileMapboxRenderPlan of the tile of @ctx for each of
+ * @stylesheets, for instance for day, night and high contrast themes.
+ * The tags of the features are extracted and their geometry decoded
+ * only once, only the styles and labels are resolved for each
+ * stylesheet. The stylesheet of @ctx is left alone.
+ *
+ * Returns: (array length=n_stylesheets) (transfer full): the plans, in
+ * the order of @stylesheets, or %NULL on error. Unref the plans and
+ * g_free() the array when done.
+ */
+VTileMapboxRenderPlan **
+vtile_mapbox_render_context_build_plans (VTileMapboxRenderContext *ctx,
+                                         VTileMapCSS **stylesheets,
+                                         guint n_stylesheets,
+                                         GError **error)
+{
+  VectorTile__Tile *tile;
+  VTileMapboxRenderPlan **plans;
+  VTileMapCSS *stylesheet;
+  guint n_features = 0;
+  guint i;
+  gint l;
+
+  g_return_val_if_fail (ctx != NULL, NULL);
+  g_return_val_if_fail (stylesheets != NULL, NULL);
+  g_return_val_if_fail (n_stylesheets > 0, NULL);
+
+  tile = ctx->tile->tile;
+  for (l = 0; l < tile->n_layers; l++)
+    n_features += tile->layers[l]->n_features;
+
+  plans = g_new0 (VTileMapboxRenderPlan *, n_stylesheets);
+  ctx->shared_features = g_new0 (MapboxSharedFeature, n_features);
+  stylesheet = ctx->stylesheet;
+
+  for (i = 0; i < n_stylesheets; i++) {
+    ctx->stylesheet = stylesheets[i];
+    plans[i] = vtile_mapbox_render_context_build_plan (ctx, error);
+    if (!plans[i])
+      break;
+  }
+
+  ctx->stylesheet = stylesheet;
+  for (i = 0; i < n_features; i++) {
+    if (ctx->shared_features[i].tags)
+      g_hash_table_unref (ctx->shared_features[i].tags);
+    if (ctx->shared_features[i].path)
+      cairo_path_destroy (ctx->shared_features[i].path);
+  }
+  g_clear_pointer (&ctx->shared_features, g_free);
+
+  for (i = 0; i < n_stylesheets; i++) {
+    if (plans[i])
+      continue;
+
+    while (i > 0)
+      vtile_mapbox_render_plan_unref (plans[--i]);
+    g_clear_pointer (&plans, g_free);
+    break;
+  }
+
+  return plans;
+}
+
+/*
+ * Lay out and draw the label of a plan text again with its font and
+ * halo scaled by @scale, rather than scaling the drawn label, and place
+ * it at the scaled position.
+ */
+static VTileMapboxText *
+mapbox_text_new_scaled (const VTileMapboxText *text,
+                        gdouble scale)
+{
+  VTileMapboxLazyLabel *lazy = text->lazy;
+  VTileMapboxLabelKey key = lazy->key;
+  VTileMapboxLabel label;
+  VTileMapboxText *scaled;
+  cairo_matrix_t matrix;
+  PangoLayout *layout;
+  gint width, height;
+  gint x, y;
+
+  x = text->offset_x + lazy->label.anchor_x;
+  y = text->offset_y + lazy->label.anchor_y;
+
+  key.font.size = round (key.font.size * scale);
+  key.halo_radius = round (key.halo_radius * scale);
+
+  layout = mapbox_get_text_layout (key.text, &key.font);
+  pango_layout_get_pixel_size (layout, &width, &height);
+  mapbox_measure_label (&key, width, height, &label, &matrix);
+  mapbox_get_label_surface (lazy->cache, &key, &matrix, &label);
+
+  scaled = g_new0 (VTileMapboxText, 1);
+  scaled->offset_x = round (x * scale) - label.anchor_x;
+  scaled->offset_y = round (y * scale) - label.anchor_y;
+  scaled->width = label.width;
+  scaled->height = label.height;
+  scaled->surface = label.surface;
+  scaled->uid = g_strdup (text->uid);
+  scaled->text = g_strdup (text->text);
+  scaled->angle = text->angle;
+
+  return scaled;
+}
+
+/* The targets of a render at several scales, drawn by worker threads */
+typedef struct {
+  VTileMapboxRenderPlan *plan;
+  cairo_t **targets;
+  const gdouble *scales;
+  GList **texts;
+} MapboxScaleBatch;
+
+static void
+mapbox_render_scale_job (guint job,
+                         MapboxScaleBatch *batch)
+{
+  cairo_t *cr = batch->targets[job];
+  gdouble scale = batch->scales[job];
+  GList *texts = NULL;
+  GList *l;
+
+  cairo_save (cr);
+  cairo_scale (cr, scale, scale);
+  vtile_mapbox_render_plan_render (batch->plan, cr);
+  cairo_restore (cr);
+
+  if (!batch->texts)
+    return;
+
+  for (l = vtile_mapbox_render_plan_get_texts (batch->plan); l; l = l->next)
+    texts = g_list_prepend (texts, mapbox_text_new_scaled (l->data, scale));
+  batch->texts[job] = g_list_reverse (texts);
+}
+
+/**
+ * vtile_mapbox_render_context_render_scales:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @targets: (array length=n_scales): the cairo contexts to render to.
+ * @scales: (array length=n_scales): the scale of each target, 2.0 for
+ * a target twice the tile size of @ctx.
+ * @n_scales: the number of targets.
+ * @texts: (out caller-allocates) (array length=n_scales) (nullable):
+ * room for the labels of each target, or %NULL.
+ * @error: a #GError, or %NULL.
+ *
+ * Render the tile of @ctx to several targets at once, for instance at
+ * 256, 512 and 1024 pixels for screens of different densities. The
+ * features are resolved and decoded once, see
+ * vtile_mapbox_render_context_build_plan(), and only the drawing is
+ * done for each target, on worker threads. Lines widen with the scale
+ * and labels are laid out again at the scaled font size, they are
+ * placed the same way on all targets.
+ *
+ * Each list of @texts holds the #VTileMapboxText of a target, in its
+ * pixels, free them with vtile_mapbox_text_free(). Labels are never put
+ * in atlases here.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_context_render_scales (VTileMapboxRenderContext *ctx,
+                                           cairo_t **targets,
+                                           const gdouble *scales,
+                                           guint n_scales,
+                                           GList **texts,
+                                           GError **error)
+{
+  VTileMapboxRenderFlags flags;
+  MapboxScaleBatch batch;
+
+  g_return_val_if_fail (ctx != NULL, FALSE);
+  g_return_val_if_fail (targets != NULL || n_scales == 0, FALSE);
+  g_return_val_if_fail (scales != NULL || n_scales == 0, FALSE);
+
+  /* Labels are drawn per target */
+  flags = ctx->flags;
+  ctx->flags = (flags | VTILE_MAPBOX_RENDER_LAZY_LABELS) &
+    ~VTILE_MAPBOX_RENDER_LABEL_ATLAS;
+  batch.plan = vtile_mapbox_render_context_build_plan (ctx, error);
+  ctx->flags = flags;
+  if (!batch.plan)
+    return FALSE;
+
+  batch.targets = targets;
+  batch.scales = scales;
+  batch.texts = texts;
+  vtile_worker_pool_run (n_scales, (VTileWorkerFunc) mapbox_render_scale_job,
+                         &batch);
+
+  vtile_mapbox_render_plan_unref (batch.plan);
 
   return TRUE;
 }
 
+typedef struct {
+  VTileMapboxRenderContext *ctx;
+  cairo_t *cr;
+  VTileMapboxGeometryReadyFunc geometry_ready;
+  gpointer geometry_data;
+} MapboxRenderAsyncData;
+
+static void
+mapbox_render_async_data_free (MapboxRenderAsyncData *data)
+{
+  vtile_mapbox_render_context_unref (data->ctx);
+  cairo_destroy (data->cr);
+  g_free (data);
+}
+
+static void
+mapbox_render_labels_thread (GTask *task,
+                             gpointer source_object,
+                             gpointer task_data,
+                             GCancellable *cancellable)
+{
+  MapboxRenderAsyncData *data = task_data;
+  GError *error = NULL;
+
+  if (mapbox_finish_labels (data->ctx)) {
+    g_task_return_boolean (task, TRUE);
+  } else {
+    mapbox_render_fail (data->ctx, &error);
+    g_task_return_error (task, error);
+  }
+}
+
+static void
+mapbox_render_geometry_thread (GTask *task,
+                               gpointer source_object,
+                               gpointer task_data,
+                               GCancellable *cancellable)
+{
+  MapboxRenderAsyncData *data = task_data;
+  GError *error = NULL;
+
+  if (mapbox_render_tile_geometry (data->ctx, data->cr)) {
+    g_task_return_boolean (task, TRUE);
+  } else {
+    mapbox_render_fail (data->ctx, &error);
+    g_task_return_error (task, error);
+  }
+}
+
+/* Hand out the geometry and start the label phase on another thread */
+static void
+mapbox_render_geometry_done (GObject *source_object,
+                             GAsyncResult *result,
+                             gpointer user_data)
+{
+  GTask *task = user_data;
+  MapboxRenderAsyncData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    g_task_return_error (task, error);
+    g_object_unref (task);
+    return;
+  }
+
+  if (data->geometry_ready)
+    data->geometry_ready (data->ctx, data->geometry_data);
+
+  g_task_run_in_thread (task, mapbox_render_labels_thread);
+  g_object_unref (task);
+}
+
+/**
+ * vtile_mapbox_render_context_render_async:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cr: the cairo context to render to.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ * @geometry_ready: (scope async) (nullable): called when the
+ * geometry of the tile is drawn, or %NULL.
+ * @geometry_data: data for @geometry_ready.
+ * @callback: called when the render, labels included, is done.
+ * @user_data: data for @callback.
+ *
+ * Render the tile of @ctx in two phases on worker threads. First the
+ * geometry is drawn to @cr, then @geometry_ready is called in the
+ * thread-default main context, and @cr can be shown while the labels
+ * are measured, placed and drawn on another thread. @ctx must not be
+ * used and @cr must not be drawn to until the render is done.
+ *
+ * If @cancellable is set it replaces the cancellable of @ctx.
+ */
+void
+vtile_mapbox_render_context_render_async (VTileMapboxRenderContext *ctx,
+                                          cairo_t *cr,
+                                          GCancellable *cancellable,
+                                          VTileMapboxGeometryReadyFunc geometry_ready,
+                                          gpointer geometry_data,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+  MapboxRenderAsyncData *data;
+  GTask *task, *geometry_task;
+
+  g_return_if_fail (ctx != NULL);
+  g_return_if_fail (cr != NULL);
+
+  if (cancellable)
+    vtile_mapbox_render_context_set_cancellable (ctx, cancellable);
+  mapbox_render_reset (ctx);
+
+  data = g_new (MapboxRenderAsyncData, 1);
+  data->ctx = vtile_mapbox_render_context_ref (ctx);
+  data->cr = cairo_reference (cr);
+  data->geometry_ready = geometry_ready;
+  data->geometry_data = geometry_data;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, vtile_mapbox_render_context_render_async);
+  g_task_set_task_data (task, data,
+                        (GDestroyNotify) mapbox_render_async_data_free);
+
+  geometry_task = g_task_new (NULL, cancellable,
+                              mapbox_render_geometry_done, task);
+  g_task_set_task_data (geometry_task, data, NULL);
+  g_task_run_in_thread (geometry_task, mapbox_render_geometry_thread);
+  g_object_unref (geometry_task);
+}
+
+/**
+ * vtile_mapbox_render_context_render_finish:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @result: a #GAsyncResult.
+ * @error: a #GError, or %NULL.
+ *
+ * Finish a render started with
+ * vtile_mapbox_render_context_render_async().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_context_render_finish (VTileMapboxRenderContext *ctx,
+                                           GAsyncResult *result,
+                                           GError **error)
+{
+  g_return_val_if_fail (ctx != NULL, FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+typedef struct {
+  VTileMapboxRenderContext *ctx;
+  VTileMapboxRenderFlags flags;
+  VTileMapboxDraftReadyFunc draft_ready;
+  gpointer draft_data;
+} MapboxProgressiveData;
+
+static void
+mapbox_progressive_data_free (MapboxProgressiveData *data)
+{
+  vtile_mapbox_render_context_unref (data->ctx);
+  g_free (data);
+}
+
+/* Render the tile of @ctx into a new surface, or return NULL */
+static cairo_surface_t *
+mapbox_render_to_surface (VTileMapboxRenderContext *ctx,
+                          GError **error)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  gboolean rendered;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        ctx->tile_size, ctx->tile_size);
+  cr = cairo_create (surface);
+
+  mapbox_render_reset (ctx);
+  rendered = mapbox_render_tile (ctx, cr, error);
+  cairo_destroy (cr);
+
+  if (!rendered) {
+    cairo_surface_destroy (surface);
+    return NULL;
+  }
+
+  return surface;
+}
+
+static void
+mapbox_render_progressive_thread (GTask *task,
+                                  gpointer source_object,
+                                  gpointer task_data,
+                                  GCancellable *cancellable)
+{
+  MapboxProgressiveData *data = task_data;
+  cairo_surface_t *surface;
+  GError *error = NULL;
+
+  surface = mapbox_render_to_surface (data->ctx, &error);
+  if (surface)
+    g_task_return_pointer (task, surface,
+                           (GDestroyNotify) cairo_surface_destroy);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+mapbox_render_draft_thread (GTask *task,
+                            gpointer source_object,
+                            gpointer task_data,
+                            GCancellable *cancellable)
+{
+  MapboxProgressiveData *data = task_data;
+
+  data->ctx->flags = data->flags | VTILE_MAPBOX_RENDER_DRAFT;
+  mapbox_render_progressive_thread (task, source_object,
+                                    task_data, cancellable);
+  data->ctx->flags = data->flags;
+}
+
+/* Hand out the draft and start the final render on another thread */
+static void
+mapbox_render_draft_done (GObject *source_object,
+                          GAsyncResult *result,
+                          gpointer user_data)
+{
+  GTask *task = user_data;
+  MapboxProgressiveData *data = g_task_get_task_data (task);
+  cairo_surface_t *draft;
+  GError *error = NULL;
+
+  draft = g_task_propagate_pointer (G_TASK (result), &error);
+  if (!draft) {
+    g_task_return_error (task, error);
+    g_object_unref (task);
+    return;
+  }
+
+  if (data->draft_ready)
+    data->draft_ready (data->ctx, draft, data->draft_data);
+  cairo_surface_destroy (draft);
+
+  g_task_run_in_thread (task, mapbox_render_progressive_thread);
+  g_object_unref (task);
+}
+
+/**
+ * vtile_mapbox_render_context_render_progressive_async:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ * @draft_ready: (scope async) (nullable): called with the draft of
+ * the tile, or %NULL.
+ * @draft_data: data for @draft_ready.
+ * @callback: called when the final render is done.
+ * @user_data: data for @callback.
+ *
+ * Render the tile of @ctx twice on worker threads, first as a draft
+ * with %VTILE_MAPBOX_RENDER_DRAFT and then with the flags of @ctx. The
+ * draft is handed to @draft_ready in the thread-default main context,
+ * so something can be shown while the final tile is rendered. Only the
+ * final render has labels. @ctx must not be used until the render is
+ * done.
+ *
+ * If @cancellable is set it replaces the cancellable of @ctx, and
+ * stops the final render as well as the draft.
+ */
+void
+vtile_mapbox_render_context_render_progressive_async (VTileMapboxRenderContext *ctx,
+                                                      GCancellable *cancellable,
+                                                      VTileMapboxDraftReadyFunc draft_ready,
+                                                      gpointer draft_data,
+                                                      GAsyncReadyCallback callback,
+                                                      gpointer user_data)
+{
+  MapboxProgressiveData *data;
+  GTask *task, *draft_task;
+
+  g_return_if_fail (ctx != NULL);
+
+  if (cancellable)
+    vtile_mapbox_render_context_set_cancellable (ctx, cancellable);
+
+  data = g_new (MapboxProgressiveData, 1);
+  data->ctx = vtile_mapbox_render_context_ref (ctx);
+  data->flags = ctx->flags;
+  data->draft_ready = draft_ready;
+  data->draft_data = draft_data;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task,
+                         vtile_mapbox_render_context_render_progressive_async);
+  g_task_set_task_data (task, data,
+                        (GDestroyNotify) mapbox_progressive_data_free);
+
+  draft_task = g_task_new (NULL, cancellable,
+                           mapbox_render_draft_done, task);
+  g_task_set_task_data (draft_task, data, NULL);
+  g_task_run_in_thread (draft_task, mapbox_render_draft_thread);
+  g_object_unref (draft_task);
+}
+
+/**
+ * vtile_mapbox_render_context_render_progressive_finish:
+ * @ctx: a #VTileMapboxRenderContext.
+ * @result: a #GAsyncResult.
+ * @error: a #GError, or %NULL.
+ *
+ * Finish a render started with
+ * vtile_mapbox_render_context_render_progressive_async(). The labels
+ * of the final render are found with
+ * vtile_mapbox_render_context_get_texts().
+ *
+ * Returns: (transfer full): the rendered tile, or %NULL on error.
+ */
+cairo_surface_t *
+vtile_mapbox_render_context_render_progressive_finish (VTileMapboxRenderContext *ctx,
+                                                       GAsyncResult *result,
+                                                       GError **error)
+{
+  g_return_val_if_fail (ctx != NULL, NULL);
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * vtile_mapbox_render_context_get_texts:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns all labels found while rendering the tile,
+ * or %NULL if none was found.
+ *
+ * With %VTILE_MAPBOX_RENDER_PLACE_LABELS labels that would overlap are
+ * left out. Labels with a higher z-index win, then labels of larger
+ * features, polygons by area and lines by length. Line labels are
+ * tested with their rotated boxes. Labels that are left out are never
+ * drawn.
+ *
+ * Returns: (transfer none) (element-type VTileMapboxText): List of
+ * #VTileMapboxText
+ */
+GList *
+vtile_mapbox_render_context_get_texts (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  return ctx->texts;
+}
+
+/**
+ * vtile_mapbox_render_context_get_label_atlases:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Returns the atlas surfaces the labels of the last render were packed
+ * into with %VTILE_MAPBOX_RENDER_LABEL_ATLAS, in the order they were
+ * filled. The surfaces stay valid as long as the texts pointing into
+ * them.
+ *
+ * Returns: (transfer none) (element-type cairo.Surface): List of
+ * #cairo_surface_t, or %NULL.
+ */
+GList *
+vtile_mapbox_render_context_get_label_atlases (VTileMapboxRenderContext *ctx)
+{
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  return ctx->atlases;
+}
+
+/**
+ * vtile_mapbox_render_context_steal_texts:
+ * @ctx: a #VTileMapboxRenderContext.
+ *
+ * Like vtile_mapbox_render_context_get_texts() but hands the labels
+ * over to the caller.
+ *
+ * Returns: (transfer full) (element-type VTileMapboxText): List of
+ * #VTileMapboxText, free with vtile_mapbox_text_free().
+ */
+GList *
+vtile_mapbox_render_context_steal_texts (VTileMapboxRenderContext *ctx)
+{
+  GList *texts;
+
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  texts = ctx->texts;
+  ctx->texts = NULL;
+
+  return texts;
+}
+
 /**
  * vtile_mapbox_render:
  * @mapbox: a #VTileMapbox object.
@@ -1338,11 +4062,52 @@ vtile_mapbox_render (VTileMapbox *mapbox,
                      cairo_t *cr,
                      GError **error)
 {
+  return vtile_mapbox_render_full (mapbox, cr, NULL, 0, error);
+}
+
+/**
+ * vtile_mapbox_render_full:
+ * @mapbox: a #VTileMapbox object.
+ * @cr: the cairo context to render to.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ * @deadline: the monotonic time by which the render must be done,
+ * or 0 for no deadline.
+ * @error: a #GError, or %NULL.
+ *
+ * Like vtile_mapbox_render() but stops early when @cancellable is
+ * cancelled or @deadline has passed, see
+ * vtile_mapbox_render_context_render().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapbox_render_full (VTileMapbox *mapbox,
+                          cairo_t *cr,
+                          GCancellable *cancellable,
+                          gint64 deadline,
+                          GError **error)
+{
+  VTileMapboxRenderContext *ctx;
+  gboolean status;
+
   g_return_val_if_fail (mapbox != NULL, FALSE);
   g_return_val_if_fail (mapbox->priv->tile != NULL, FALSE);
   g_return_val_if_fail (cr != NULL, FALSE);
 
-  return mapbox_render_tile (mapbox, mapbox->priv->tile, cr);
+  ctx = vtile_mapbox_render_context_new (mapbox->priv->tile,
+                                         mapbox->priv->stylesheet,
+                                         mapbox->priv->tile_size,
+                                         mapbox->priv->zoom_level);
+  vtile_mapbox_render_context_set_cancellable (ctx, cancellable);
+  vtile_mapbox_render_context_set_deadline (ctx, deadline);
+  status = vtile_mapbox_render_context_render (ctx, cr, error);
+
+  g_list_free_full (mapbox->priv->texts,
+                    (GDestroyNotify) vtile_mapbox_text_free);
+  mapbox->priv->texts = vtile_mapbox_render_context_steal_texts (ctx);
+  vtile_mapbox_render_context_unref (ctx);
+
+  return status;
 }
 
 static void
@@ -1470,8 +4235,8 @@ vtile_mapbox_dump_info (VTileMapbox *mapbox,
  * vtile_mapbox_get_texts:
  * @mapbox: A #VTileMapbox object.
  *
- * Returns all labels found while rendering the tile,
- * or %NULL if none was found.
+ * Returns the labels found while rendering the tile that do not
+ * overlap, or %NULL if none was found.
  *
  * Returns: (element-type VTileMapboxText) List of #VTileMapboxText
  */
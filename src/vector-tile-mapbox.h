@@ -22,6 +22,10 @@
 #include <pango/pango.h>
 
 #include "vector-tile-mapcss.h"
+#include "vector-tile-mapbox-tile.h"
+#include "vector-tile-mapbox-label-cache.h"
+#include "vector-tile-mapbox-label-registry.h"
+#include "vector-tile-mapbox-render-plan.h"
 
 G_BEGIN_DECLS
 
@@ -49,6 +53,108 @@ struct _VTileMapboxClass {
   GObjectClass parent_class;
 };
 
+/**
+ * VTileMapboxRenderContext:
+ *
+ * The state of a single render of a #VTileMapboxTile: the stylesheet,
+ * the target size and the labels produced.
+ */
+typedef struct _VTileMapboxRenderContext VTileMapboxRenderContext;
+
+/**
+ * VTileMapboxGeometryReadyFunc:
+ * @ctx: the #VTileMapboxRenderContext being rendered.
+ * @user_data: the data passed with the function.
+ *
+ * Called when the geometry of a tile is drawn, while its labels are
+ * still being placed and drawn.
+ */
+typedef void (*VTileMapboxGeometryReadyFunc) (VTileMapboxRenderContext *ctx,
+                                              gpointer user_data);
+
+/**
+ * VTileMapboxDraftReadyFunc:
+ * @ctx: the #VTileMapboxRenderContext being rendered.
+ * @draft: the draft of the tile.
+ * @user_data: the data passed with the function.
+ *
+ * Called with the draft of a progressive render, while the tile is
+ * rendered at full quality. Take a reference to @draft to keep it.
+ */
+typedef void (*VTileMapboxDraftReadyFunc) (VTileMapboxRenderContext *ctx,
+                                           cairo_surface_t *draft,
+                                           gpointer user_data);
+
+/**
+ * VTileMapboxRenderFlags:
+ * @VTILE_MAPBOX_RENDER_DEFAULT: Render everything on the calling thread.
+ * @VTILE_MAPBOX_RENDER_PARALLEL_STYLE: Resolve the tags and styles of
+ * large tiles on several threads.
+ * @VTILE_MAPBOX_RENDER_PARALLEL_LAYERS: Draw each render layer into its
+ * own image surface on a separate thread and composite them in order.
+ * Only used when rendering to an image surface.
+ * @VTILE_MAPBOX_RENDER_PLACE_LABELS: Only keep the labels that do not
+ * collide with more important ones, see
+ * vtile_mapbox_render_context_get_texts().
+ * @VTILE_MAPBOX_RENDER_LABEL_ATLAS: Pack the labels into a few shared
+ * atlas surfaces instead of one surface per label.
+ * @VTILE_MAPBOX_RENDER_MASK_HALOS: Draw label halos by growing an alpha
+ * mask of the glyphs instead of stroking the glyph outlines. This is
+ * much faster, the halos come close to the stroked ones but their edges
+ * are not the same pixel for pixel.
+ * @VTILE_MAPBOX_RENDER_LAZY_LABELS: Only measure and place labels, they
+ * are drawn when asked for, see vtile_mapbox_text_get_surface(). Not
+ * used together with %VTILE_MAPBOX_RENDER_LABEL_ATLAS.
+ * @VTILE_MAPBOX_RENDER_DRAFT: Render a quick draft: no antialiasing, no
+ * casings, no labels, polygons filled without outlines and geometry
+ * simplified to a couple of pixels.
+ * @VTILE_MAPBOX_RENDER_FAST_FILLS: Fill opaque polygons drawn to an
+ * ARGB32 or RGB24 image surface with a built-in scanline filler. When
+ * antialiasing, the pixels a polygon covers whole are written directly
+ * and only those along its edges are left to cairo, so the image is the
+ * same as without the flag. Outlines, transparent fills and labels are
+ * still drawn by cairo.
+ *
+ * Flags controlling how a #VTileMapboxRenderContext renders. Resolving
+ * styles in parallel does not change the rendered image. Compositing
+ * separately drawn layers gives the same image as drawing them in
+ * sequence, except that translucent pixels where layers overlap can
+ * differ by one step of rounding.
+ */
+typedef enum {
+  VTILE_MAPBOX_RENDER_DEFAULT         = 0,
+  VTILE_MAPBOX_RENDER_PARALLEL_STYLE  = 1 << 0,
+  VTILE_MAPBOX_RENDER_PARALLEL_LAYERS = 1 << 1,
+  VTILE_MAPBOX_RENDER_PLACE_LABELS    = 1 << 2,
+  VTILE_MAPBOX_RENDER_LABEL_ATLAS     = 1 << 3,
+  VTILE_MAPBOX_RENDER_MASK_HALOS      = 1 << 4,
+  VTILE_MAPBOX_RENDER_LAZY_LABELS     = 1 << 5,
+  VTILE_MAPBOX_RENDER_DRAFT           = 1 << 6,
+  VTILE_MAPBOX_RENDER_FAST_FILLS      = 1 << 7
+} VTileMapboxRenderFlags;
+
+/**
+ * VTileMapboxText:
+ * @offset_x: where to place the label, in tile pixels.
+ * @offset_y: where to place the label, in tile pixels.
+ * @width: the width of the label.
+ * @height: the height of the label.
+ * @surface: the surface holding the rendered label, shared with the
+ * label cache, other labels or an atlas, so it must not be drawn to.
+ * @uid: the uid of the feature the label belongs to.
+ * @atlas_x: where the label is on @surface.
+ * @atlas_y: where the label is on @surface.
+ * @text: the text of the label.
+ * @angle: the rotation of the label in radians.
+ *
+ * A label of a rendered tile. The label is the @width by @height
+ * rectangle of @surface at @atlas_x, @atlas_y, which is the whole
+ * surface unless %VTILE_MAPBOX_RENDER_LABEL_ATLAS is used.
+ *
+ * With %VTILE_MAPBOX_RENDER_LAZY_LABELS @surface is %NULL until
+ * vtile_mapbox_text_get_surface() or vtile_mapbox_texts_rasterize()
+ * draws the label.
+ */
 typedef struct {
   gint offset_x;
   gint offset_y;
@@ -56,18 +162,72 @@ typedef struct {
   gint height;
   cairo_surface_t *surface;
   char *uid;
+  gint atlas_x;
+  gint atlas_y;
+  char *text;
+  gdouble angle;
+
+  /* <private> */
+  gpointer lazy;
 } VTileMapboxText;
 
+/**
+ * VTileMapboxLayerFlags:
+ * @VTILE_MAPBOX_LAYER_EARTH: Land.
+ * @VTILE_MAPBOX_LAYER_LANDUSE: Land use areas.
+ * @VTILE_MAPBOX_LAYER_WATER: Water.
+ * @VTILE_MAPBOX_LAYER_LANDUSE_NATURE: Woods, scrub and rock.
+ * @VTILE_MAPBOX_LAYER_PLACES: Place names.
+ * @VTILE_MAPBOX_LAYER_ROADS: Roads.
+ * @VTILE_MAPBOX_LAYER_BUILDINGS: Buildings.
+ * @VTILE_MAPBOX_LAYER_BRIDGE_TUNNEL: Bridges and tunnels.
+ * @VTILE_MAPBOX_LAYER_POI: Points of interest.
+ *
+ * The layers a tile is rendered in, from bottom to top.
+ */
+typedef enum {
+  VTILE_MAPBOX_LAYER_EARTH          = 1 << 0,
+  VTILE_MAPBOX_LAYER_LANDUSE        = 1 << 1,
+  VTILE_MAPBOX_LAYER_WATER          = 1 << 2,
+  VTILE_MAPBOX_LAYER_LANDUSE_NATURE = 1 << 3,
+  VTILE_MAPBOX_LAYER_PLACES         = 1 << 4,
+  VTILE_MAPBOX_LAYER_ROADS          = 1 << 5,
+  VTILE_MAPBOX_LAYER_BUILDINGS      = 1 << 6,
+  VTILE_MAPBOX_LAYER_BRIDGE_TUNNEL  = 1 << 7,
+  VTILE_MAPBOX_LAYER_POI            = 1 << 8
+} VTileMapboxLayerFlags;
+
+/**
+ * VTileMapboxLayerDoneFunc:
+ * @ctx: the #VTileMapboxRenderContext being rendered.
+ * @layer: the layer that was drawn.
+ * @damage: the region of the tile, in tile pixels, the layer drew to.
+ * @user_data: the data passed with the function.
+ *
+ * Called each time a layer of a tile has been drawn, see
+ * vtile_mapbox_render_context_set_layer_done_func().
+ */
+typedef void (*VTileMapboxLayerDoneFunc) (VTileMapboxRenderContext *ctx,
+                                          VTileMapboxLayerFlags layer,
+                                          const cairo_rectangle_int_t *damage,
+                                          gpointer user_data);
+
 #define VTILE_MAPBOX_ERROR (vtile_mapbox_error_quark ())
 
 /**
  * VTileMapboxError:
  * @VTILE_MAPBOX:ERROR_LOAD: An error occured loading the tile.
+ * @VTILE_MAPBOX_ERROR_QUEUE_FULL: A render request was pushed out of a
+ * full #VTileMapboxScheduler queue by more urgent requests.
+ * @VTILE_MAPBOX_ERROR_INVALID_PLAN: A serialized #VTileMapboxRenderPlan
+ * is damaged or of an unknown version.
  *
  * Error codes returned by vtile_mapbox functions.
  */
 typedef enum {
-  VTILE_MAPBOX_ERROR_LOAD
+  VTILE_MAPBOX_ERROR_LOAD,
+  VTILE_MAPBOX_ERROR_QUEUE_FULL,
+  VTILE_MAPBOX_ERROR_INVALID_PLAN
 } VTileMapboxError;
 
 VTileMapbox *vtile_mapbox_new (guint tile_size,
@@ -83,12 +243,19 @@ vtile_mapbox_load_from_file (VTileMapbox *mapbox,
                              const char *filename,
                              GError **error);
 
+VTileMapboxTile *vtile_mapbox_get_tile (VTileMapbox *mapbox);
+
 void vtile_mapbox_set_stylesheet (VTileMapbox *mapbox,
                                   VTileMapCSS *stylesheet);
 
 gboolean vtile_mapbox_render (VTileMapbox *mapbox,
                               cairo_t *cr,
                               GError **error);
+gboolean vtile_mapbox_render_full (VTileMapbox *mapbox,
+                                   cairo_t *cr,
+                                   GCancellable *cancellable,
+                                   gint64 deadline,
+                                   GError **error);
 
 void vtile_mapbox_render_async (VTileMapbox *mapbox,
                                 cairo_t *cr,
@@ -101,9 +268,113 @@ gboolean vtile_mapbox_render_finish (VTileMapbox *mapbox,
 
 GList *vtile_mapbox_get_texts (VTileMapbox *mapbox);
 
+VTileMapboxRenderContext *
+vtile_mapbox_render_context_new (VTileMapboxTile *tile,
+                                 VTileMapCSS *stylesheet,
+                                 guint tile_size,
+                                 guint zoom_level);
+VTileMapboxRenderContext *
+vtile_mapbox_render_context_ref (VTileMapboxRenderContext *ctx);
+void vtile_mapbox_render_context_unref (VTileMapboxRenderContext *ctx);
+
+guint vtile_mapbox_render_context_get_tile_size (VTileMapboxRenderContext *ctx);
+
+void vtile_mapbox_render_context_set_flags (VTileMapboxRenderContext *ctx,
+                                            VTileMapboxRenderFlags flags);
+VTileMapboxRenderFlags
+vtile_mapbox_render_context_get_flags (VTileMapboxRenderContext *ctx);
+
+void
+vtile_mapbox_render_context_set_cancellable (VTileMapboxRenderContext *ctx,
+                                             GCancellable *cancellable);
+GCancellable *
+vtile_mapbox_render_context_get_cancellable (VTileMapboxRenderContext *ctx);
+void vtile_mapbox_render_context_set_deadline (VTileMapboxRenderContext *ctx,
+                                               gint64 deadline);
+void
+vtile_mapbox_render_context_set_time_budget (VTileMapboxRenderContext *ctx,
+                                             gint64 budget);
+VTileMapboxLayerFlags
+vtile_mapbox_render_context_get_skipped_layers (VTileMapboxRenderContext *ctx);
+void
+vtile_mapbox_render_context_set_label_cache (VTileMapboxRenderContext *ctx,
+                                             VTileMapboxLabelCache *cache);
+void
+vtile_mapbox_render_context_set_layer_done_func (VTileMapboxRenderContext *ctx,
+                                                 VTileMapboxLayerDoneFunc layer_done,
+                                                 gpointer user_data);
+void
+vtile_mapbox_render_context_set_label_registry (VTileMapboxRenderContext *ctx,
+                                                VTileMapboxLabelRegistry *registry,
+                                                guint x,
+                                                guint y);
+
+gboolean vtile_mapbox_render_context_render (VTileMapboxRenderContext *ctx,
+                                             cairo_t *cr,
+                                             GError **error);
+
+gboolean
+vtile_mapbox_render_context_render_to_data (VTileMapboxRenderContext *ctx,
+                                            guchar *data,
+                                            cairo_format_t format,
+                                            gint stride,
+                                            GError **error);
+gboolean
+vtile_mapbox_render_context_render_region (VTileMapboxRenderContext *ctx,
+                                           cairo_t *cr,
+                                           const cairo_rectangle_int_t *region,
+                                           GError **error);
+VTileMapboxRenderPlan *
+vtile_mapbox_render_context_build_plan (VTileMapboxRenderContext *ctx,
+                                        GError **error);
+VTileMapboxRenderPlan **
+vtile_mapbox_render_context_build_plans (VTileMapboxRenderContext *ctx,
+                                         VTileMapCSS **stylesheets,
+                                         guint n_stylesheets,
+                                         GError **error);
+gboolean
+vtile_mapbox_render_context_render_scales (VTileMapboxRenderContext *ctx,
+                                           cairo_t **targets,
+                                           const gdouble *scales,
+                                           guint n_scales,
+                                           GList **texts,
+                                           GError **error);
+
+void
+vtile_mapbox_render_context_render_async (VTileMapboxRenderContext *ctx,
+                                          cairo_t *cr,
+                                          GCancellable *cancellable,
+                                          VTileMapboxGeometryReadyFunc geometry_ready,
+                                          gpointer geometry_data,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
+gboolean
+vtile_mapbox_render_context_render_finish (VTileMapboxRenderContext *ctx,
+                                           GAsyncResult *result,
+                                           GError **error);
+
+void
+vtile_mapbox_render_context_render_progressive_async (VTileMapboxRenderContext *ctx,
+                                                      GCancellable *cancellable,
+                                                      VTileMapboxDraftReadyFunc draft_ready,
+                                                      gpointer draft_data,
+                                                      GAsyncReadyCallback callback,
+                                                      gpointer user_data);
+cairo_surface_t *
+vtile_mapbox_render_context_render_progressive_finish (VTileMapboxRenderContext *ctx,
+                                                       GAsyncResult *result,
+                                                       GError **error);
+
+GList *vtile_mapbox_render_context_get_texts (VTileMapboxRenderContext *ctx);
+GList *vtile_mapbox_render_context_steal_texts (VTileMapboxRenderContext *ctx);
+GList *
+vtile_mapbox_render_context_get_label_atlases (VTileMapboxRenderContext *ctx);
+
 GQuark vtile_mapbox_error_quark (void);
 
 void vtile_mapbox_text_free (VTileMapboxText *text);
+cairo_surface_t *vtile_mapbox_text_get_surface (VTileMapboxText *text);
+void vtile_mapbox_texts_rasterize (GList *texts);
 
 G_END_DECLS
 
@@ -38,8 +38,11 @@ typedef struct {
   char *value;
 } VTileMapCSSTest;
 
+typedef struct _VTileMapCSSRules VTileMapCSSRules;
+
 struct _VTileMapCSSStyle {
   GHashTable *properties;
+  VTileMapCSSRules *rules;
 };
 
 #ifndef YYSTYPE
@@ -63,6 +66,9 @@ void vtile_mapcss_test_free (VTileMapCSSTest *test);
 
 VTileMapCSSValue *vtile_mapcss_value_new ();
 void vtile_mapcss_value_free (VTileMapCSSValue *value);
+
+VTileMapCSSRules *vtile_mapcss_rules_ref (VTileMapCSSRules *rules);
+void vtile_mapcss_rules_unref (VTileMapCSSRules *rules);
 G_END_DECLS
 
 #endif /* VECTOR_TILE_MAPCSS_PRIVATE */
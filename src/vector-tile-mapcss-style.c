@@ -343,5 +343,7 @@ vtile_mapcss_style_free (VTileMapCSSStyle *style)
   g_return_if_fail (style != NULL);
 
   g_hash_table_unref (style->properties);
+  if (style->rules)
+    vtile_mapcss_rules_unref (style->rules);
   g_free (style);
 }
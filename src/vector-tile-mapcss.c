@@ -36,8 +36,21 @@ enum {
   PROP_COLUMN
 };
 
-struct _VTileMapCSSPrivate {
+/*
+ * A parsed set of selectors. The stylesheet publishes one rule set at a
+ * time, every style handed out keeps a reference to the rule set it was
+ * resolved from since it points into the declarations of its selectors.
+ */
+struct _VTileMapCSSRules {
+  volatile gint ref_count;
   GList *selectors[VTILE_MAPCSS_SELECTOR_TYPE_LAST];
+};
+
+struct _VTileMapCSSPrivate {
+  VTileMapCSSRules *rules;
+  VTileMapCSSRules *pending;
+  GMutex rules_lock;
+  GMutex load_lock;
   guint lineno;
   guint column;
   char *text;
@@ -47,8 +60,85 @@ struct _VTileMapCSSPrivate {
 
 G_DEFINE_TYPE_WITH_PRIVATE (VTileMapCSS, vtile_mapcss, G_TYPE_OBJECT)
 
+/* The scanner and the parser share the global yylval */
+G_LOCK_DEFINE_STATIC (parser);
+
 void *ParseAlloc(void *(*mallocProc)(size_t));
 
+static VTileMapCSSRules *
+vtile_mapcss_rules_new (void)
+{
+  VTileMapCSSRules *rules = g_new0 (VTileMapCSSRules, 1);
+
+  rules->ref_count = 1;
+
+  return rules;
+}
+
+/**
+ * vtile_mapcss_rules_ref: (skip)
+ */
+VTileMapCSSRules *
+vtile_mapcss_rules_ref (VTileMapCSSRules *rules)
+{
+  g_return_val_if_fail (rules != NULL, NULL);
+
+  g_atomic_int_inc (&rules->ref_count);
+
+  return rules;
+}
+
+/**
+ * vtile_mapcss_rules_unref: (skip)
+ */
+void
+vtile_mapcss_rules_unref (VTileMapCSSRules *rules)
+{
+  gint i;
+
+  g_return_if_fail (rules != NULL);
+
+  if (!g_atomic_int_dec_and_test (&rules->ref_count))
+    return;
+
+  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++)
+    g_list_free_full (rules->selectors[i], g_object_unref);
+
+  g_free (rules);
+}
+
+/*
+ * Returns a reference to the currently published rule set. The lock is
+ * only held while taking the reference so that a concurrent reload can
+ * not free the rule set in between.
+ */
+static VTileMapCSSRules *
+vtile_mapcss_acquire_rules (VTileMapCSS *mapcss)
+{
+  VTileMapCSSRules *rules;
+
+  g_mutex_lock (&mapcss->priv->rules_lock);
+  rules = vtile_mapcss_rules_ref (mapcss->priv->rules);
+  g_mutex_unlock (&mapcss->priv->rules_lock);
+
+  return rules;
+}
+
+/* Atomically replace the published rule set with @rules */
+static void
+vtile_mapcss_publish_rules (VTileMapCSS *mapcss,
+                            VTileMapCSSRules *rules)
+{
+  VTileMapCSSRules *old_rules;
+
+  g_mutex_lock (&mapcss->priv->rules_lock);
+  old_rules = mapcss->priv->rules;
+  mapcss->priv->rules = rules;
+  g_mutex_unlock (&mapcss->priv->rules_lock);
+
+  vtile_mapcss_rules_unref (old_rules);
+}
+
 GQuark
 vtile_mapcss_error_quark (void)
 {
@@ -59,13 +149,13 @@ static void
 vtile_mapcss_finalize (GObject *vmapcss)
 {
   VTileMapCSS *mapcss = VTILE_MAPCSS (vmapcss);
-  gint i;
 
   if (mapcss->priv->parse_error)
     g_free (mapcss->priv->parse_error);
 
-  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++)
-    g_list_free_full (mapcss->priv->selectors[i], g_object_unref);
+  vtile_mapcss_rules_unref (mapcss->priv->rules);
+  g_mutex_clear (&mapcss->priv->rules_lock);
+  g_mutex_clear (&mapcss->priv->load_lock);
 
   if (mapcss->priv->search_path)
     g_free (mapcss->priv->search_path);
@@ -140,17 +230,17 @@ vtile_mapcss_class_init (VTileMapCSSClass *klass)
 static void
 vtile_mapcss_init (VTileMapCSS *mapcss)
 {
-  gint i;
-
   mapcss->priv = vtile_mapcss_get_instance_private (mapcss);
   mapcss->priv->lineno = 0;
   mapcss->priv->column = 0;
   mapcss->priv->text = NULL;
   mapcss->priv->parse_error = NULL;
   mapcss->priv->search_path = NULL;
+  mapcss->priv->rules = vtile_mapcss_rules_new ();
+  mapcss->priv->pending = NULL;
 
-  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++)
-    mapcss->priv->selectors[i] = NULL;
+  g_mutex_init (&mapcss->priv->rules_lock);
+  g_mutex_init (&mapcss->priv->load_lock);
 }
 
 /**
@@ -178,6 +268,7 @@ vtile_mapcss_parse (VTileMapCSS *mapcss, guint8 *data, gssize size,
   gint lex_code;
   gboolean ret = TRUE;
 
+  G_LOCK (parser);
   yylex_init_extra (mapcss, &scanner);
 
   buffer_state = yy_scan_buffer (data, size, scanner);
@@ -208,6 +299,7 @@ vtile_mapcss_parse (VTileMapCSS *mapcss, guint8 *data, gssize size,
   yy_delete_buffer(buffer_state, scanner);
   yylex_destroy(scanner);
   ParseFree(lemon_mapcss, free);
+  G_UNLOCK (parser);
 
   return ret;
 }
@@ -249,22 +341,11 @@ vtile_mapcss_get_search_path (VTileMapCSS *mapcss)
   return mapcss->priv->search_path;
 }
 
-/**
- * vtile_mapcss_load:
- * @mapcss: a #VTileMapCSS object.
- * @filename: the path to the mapcss file to load.
- * @error: a #GError, or %NULL.
- *
- * Parses a mapcss file and populates the @mapcss object.
- * On error, the parse or syntax error can be found in @error.
- *
- * Returns: %TRUE on success, %FALSE on error.
- */
-gboolean
-vtile_mapcss_load (VTileMapCSS *mapcss,
-                   const char *filename,
-                   GError **error)
- {
+static gboolean
+vtile_mapcss_load_rules (VTileMapCSS *mapcss,
+                         const char *filename,
+                         GError **error)
+{
   GFile *file;
   GFileInfo *info;
   GFileInputStream *stream;
@@ -274,16 +355,6 @@ vtile_mapcss_load (VTileMapCSS *mapcss,
   guint8 *buffer;
   gint i;
 
-  g_return_val_if_fail (mapcss != NULL, FALSE);
-  g_return_val_if_fail (filename != NULL, FALSE);
-
-  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++) {
-    if (mapcss->priv->selectors[i]) {
-      g_list_free_full (mapcss->priv->selectors[i], g_object_unref);
-      mapcss->priv->selectors[i] = NULL;
-    }
-  }
-
   file = g_file_new_for_path (filename);
   info = g_file_query_info (file,
                             G_FILE_ATTRIBUTE_STANDARD_SIZE,
@@ -331,12 +402,120 @@ vtile_mapcss_load (VTileMapCSS *mapcss,
   status = vtile_mapcss_parse (mapcss, buffer, size + 2, error);
   g_free (buffer);
 
-  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++)
-    mapcss->priv->selectors[i] = g_list_reverse (mapcss->priv->selectors[i]);
+  for (i = 0; i < VTILE_MAPCSS_SELECTOR_TYPE_LAST; i++) {
+    mapcss->priv->pending->selectors[i] =
+      g_list_reverse (mapcss->priv->pending->selectors[i]);
+  }
 
   return status;
 }
 
+/**
+ * vtile_mapcss_load:
+ * @mapcss: a #VTileMapCSS object.
+ * @filename: the path to the mapcss file to load.
+ * @error: a #GError, or %NULL.
+ *
+ * Parses a mapcss file and populates the @mapcss object.
+ * On error, the parse or syntax error can be found in @error.
+ *
+ * The new rules are built on the side and replace the current ones
+ * atomically once the whole file has been parsed, so this can be called
+ * while other threads are rendering with @mapcss. Styles already handed
+ * out keep using the rules they were resolved from. On error the
+ * current rules are left untouched.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapcss_load (VTileMapCSS *mapcss,
+                   const char *filename,
+                   GError **error)
+{
+  gboolean status;
+
+  g_return_val_if_fail (mapcss != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  g_mutex_lock (&mapcss->priv->load_lock);
+
+  g_clear_pointer (&mapcss->priv->parse_error, g_free);
+  mapcss->priv->pending = vtile_mapcss_rules_new ();
+
+  status = vtile_mapcss_load_rules (mapcss, filename, error);
+  if (status)
+    vtile_mapcss_publish_rules (mapcss, mapcss->priv->pending);
+  else
+    vtile_mapcss_rules_unref (mapcss->priv->pending);
+  mapcss->priv->pending = NULL;
+
+  g_mutex_unlock (&mapcss->priv->load_lock);
+
+  return status;
+}
+
+static void
+vtile_mapcss_load_thread (GTask *task,
+                          VTileMapCSS *mapcss,
+                          const char *filename,
+                          GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (vtile_mapcss_load (mapcss, filename, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+/**
+ * vtile_mapcss_load_async:
+ * @mapcss: a #VTileMapCSS object.
+ * @filename: the path to the mapcss file to load.
+ * @cancellable: (nullable): a #GCancellable, or %NULL.
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied.
+ * @user_data: the data to pass to callback function.
+ *
+ * Parses @filename in a worker thread and swaps in the new rules when
+ * done, see vtile_mapcss_load(). Renders in progress are not paused.
+ */
+void
+vtile_mapcss_load_async (VTileMapCSS *mapcss,
+                         const char *filename,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (mapcss != NULL);
+  g_return_if_fail (filename != NULL);
+
+  task = g_task_new (mapcss, cancellable, callback, user_data);
+  g_task_set_task_data (task, g_strdup (filename), g_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc) vtile_mapcss_load_thread);
+  g_object_unref (task);
+}
+
+/**
+ * vtile_mapcss_load_finish:
+ * @mapcss: a #VTileMapCSS object.
+ * @result: a #GAsyncResult.
+ * @error: a #GError, or %NULL.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+vtile_mapcss_load_finish (VTileMapCSS *mapcss,
+                          GAsyncResult *result,
+                          GError **error)
+{
+  g_return_val_if_fail (mapcss != NULL, FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, mapcss), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * vtile_mapcss_set_error: (skip)
  */
@@ -385,13 +564,15 @@ void
 vtile_mapcss_add_selector (VTileMapCSS *mapcss,
                            VTileMapCSSSelector *selector)
 {
+  VTileMapCSSRules *rules;
   VTileMapCSSSelectorType type;
 
   g_return_if_fail (mapcss != NULL);
+  g_return_if_fail (mapcss->priv->pending != NULL);
 
+  rules = mapcss->priv->pending;
   type = vtile_mapcss_selector_get_selector_type (selector);
-  mapcss->priv->selectors[type] = g_list_prepend (mapcss->priv->selectors[type],
-                                                  selector);
+  rules->selectors[type] = g_list_prepend (rules->selectors[type], selector);
 }
 
 /*
@@ -493,6 +674,7 @@ vtile_mapcss_match_zoom (VTileMapCSSSelector *selector,
  *
  * Get a #VTileMapCSSStyle object that represents the style
  * for the @type with the supplied @tags at the given @zoom_level.
+ * The style stays valid if @mapcss is reloaded meanwhile.
  *
  * Returns: a new #VTileMapCSSStyle object, free with vtile_mapcss_style_free().
  */
@@ -508,7 +690,8 @@ vtile_mapcss_get_style (VTileMapCSS *mapcss,
   g_return_val_if_fail (mapcss != NULL, NULL);
 
   style = vtile_mapcss_style_new ();
-  selector_list = mapcss->priv->selectors[type];
+  style->rules = vtile_mapcss_acquire_rules (mapcss);
+  selector_list = style->rules->selectors[type];
   if (selector_list) {
     for (l = selector_list; l != NULL; l = l->next) {
       VTileMapCSSSelector *selector = l->data;
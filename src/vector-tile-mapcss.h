@@ -55,6 +55,14 @@ char * vtile_mapcss_get_search_path (VTileMapCSS *mapcss);
 gboolean vtile_mapcss_load (VTileMapCSS *mapcss,
                             const char *filename,
                             GError **error);
+void vtile_mapcss_load_async (VTileMapCSS *mapcss,
+                              const char *filename,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback,
+                              gpointer user_data);
+gboolean vtile_mapcss_load_finish (VTileMapCSS *mapcss,
+                                   GAsyncResult *result,
+                                   GError **error);
 VTileMapCSSStyle *vtile_mapcss_get_style (VTileMapCSS *mapcss,
                                           VTileMapCSSSelectorType type,
                                           GHashTable *tags,
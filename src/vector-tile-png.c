@@ -0,0 +1,348 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "vector-tile-png.h"
+
+/*
+ * Paletted PNG output. The colours of a tile come from the stylesheet,
+ * so apart from the antialiased edges a tile has few of them. The most
+ * common colours make up the palette, which then is the palette of the
+ * stylesheet, and the blended edge colours are mapped to the closest
+ * colour in it. Each distinct colour is only looked up once.
+ */
+#define PNG_MAX_COLORS 256
+
+static const guint8 png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n',
+                                        0x1a, '\n' };
+
+typedef struct {
+  guint32 color;
+  guint count;
+} PngColor;
+
+static gint
+png_color_compare (gconstpointer data_a,
+                   gconstpointer data_b)
+{
+  const PngColor *a = data_a;
+  const PngColor *b = data_b;
+
+  if (a->count != b->count)
+    return a->count < b->count ? 1 : -1;
+
+  return a->color < b->color ? -1 : a->color > b->color;
+}
+
+/* Turn a premultiplied cairo pixel into straight alpha ARGB */
+static guint32
+png_unpremultiply (guint32 pixel)
+{
+  guint alpha = pixel >> 24;
+  guint r, g, b;
+
+  if (alpha == 0)
+    return 0;
+  if (alpha == 0xff)
+    return pixel;
+
+  r = (((pixel >> 16) & 0xff) * 255 + alpha / 2) / alpha;
+  g = (((pixel >> 8) & 0xff) * 255 + alpha / 2) / alpha;
+  b = ((pixel & 0xff) * 255 + alpha / 2) / alpha;
+
+  return alpha << 24 | r << 16 | g << 8 | b;
+}
+
+static guint
+png_color_distance (guint32 a,
+                    guint32 b)
+{
+  guint distance = 0;
+  gint shift;
+
+  for (shift = 0; shift < 32; shift += 8) {
+    gint d = (gint) ((a >> shift) & 0xff) - (gint) ((b >> shift) & 0xff);
+
+    distance += d * d;
+  }
+
+  return distance;
+}
+
+static guint
+png_closest_color (const guint32 *palette,
+                   guint n_colors,
+                   guint32 color)
+{
+  guint best = 0;
+  guint best_distance = G_MAXUINT;
+  guint i;
+
+  for (i = 0; i < n_colors && best_distance > 0; i++) {
+    guint distance = png_color_distance (palette[i], color);
+
+    if (distance < best_distance) {
+      best = i;
+      best_distance = distance;
+    }
+  }
+
+  return best;
+}
+
+static guint32
+png_crc (const guint8 *data,
+         gsize length,
+         guint32 crc)
+{
+  static gsize initialized = 0;
+  static guint32 table[256];
+  gsize i;
+
+  /* Tiles can be written from several threads at once */
+  if (g_once_init_enter (&initialized)) {
+    guint32 n, k, c;
+
+    for (n = 0; n < 256; n++) {
+      c = n;
+      for (k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    g_once_init_leave (&initialized, 1);
+  }
+
+  for (i = 0; i < length; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+static void
+png_put_uint (guint8 *data,
+              guint32 value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static void
+png_append_uint (GByteArray *png,
+                 guint32 value)
+{
+  guint8 data[4];
+
+  png_put_uint (data, value);
+  g_byte_array_append (png, data, 4);
+}
+
+static void
+png_append_chunk (GByteArray *png,
+                  const char *type,
+                  const guint8 *data,
+                  gsize length)
+{
+  guint32 crc;
+
+  png_append_uint (png, length);
+  g_byte_array_append (png, (const guint8 *) type, 4);
+  if (length)
+    g_byte_array_append (png, data, length);
+
+  crc = png_crc ((const guint8 *) type, 4, 0xffffffff);
+  crc = png_crc (data, length, crc);
+  png_append_uint (png, crc ^ 0xffffffff);
+}
+
+static GBytes *
+png_compress (const guint8 *data,
+              gsize length,
+              gint level,
+              GError **error)
+{
+  GZlibCompressor *compressor;
+  GOutputStream *memory, *stream;
+  GBytes *bytes;
+  gboolean written;
+
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, level);
+  memory = g_memory_output_stream_new_resizable ();
+  stream = g_converter_output_stream_new (memory, G_CONVERTER (compressor));
+
+  written = g_output_stream_write_all (stream, data, length, NULL,
+                                       NULL, error) &&
+    g_output_stream_close (stream, NULL, error);
+
+  g_object_unref (stream);
+  g_object_unref (compressor);
+  if (!written) {
+    g_object_unref (memory);
+    return NULL;
+  }
+
+  bytes =
+    g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory));
+  g_object_unref (memory);
+
+  return bytes;
+}
+
+/*
+ * Write the ARGB32 or RGB24 image @surface to @filename as an 8-bit
+ * paletted PNG, compressed at @level, 0 to 9. A surface with at most
+ * 256 colours is written without loss. RGB24 pixels are taken as
+ * opaque, whatever their unused byte holds.
+ */
+gboolean
+vtile_png_write_indexed (cairo_surface_t *surface,
+                         const char *filename,
+                         gint level,
+                         GError **error)
+{
+  gint width, height, stride;
+  guint32 opaque;
+  const guint8 *pixels;
+  GHashTable *indices;
+  GHashTableIter iter;
+  gpointer key, value;
+  GArray *colors;
+  guint32 palette[PNG_MAX_COLORS];
+  guint8 entries[PNG_MAX_COLORS * 3];
+  guint8 alphas[PNG_MAX_COLORS];
+  guint n_colors, n_alphas = 0;
+  guint8 *rows;
+  guint8 header[13];
+  GByteArray *png;
+  GBytes *idat;
+  gboolean written;
+  guint i;
+  gint x, y;
+
+  g_return_val_if_fail (surface != NULL, FALSE);
+  g_return_val_if_fail (cairo_image_surface_get_format (surface) ==
+                        CAIRO_FORMAT_ARGB32 ||
+                        cairo_image_surface_get_format (surface) ==
+                        CAIRO_FORMAT_RGB24, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (level >= 0 && level <= 9, FALSE);
+
+  width = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  opaque = cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24 ?
+    0xff000000 : 0;
+
+  cairo_surface_flush (surface);
+  pixels = cairo_image_surface_get_data (surface);
+
+  /* Count the colours, the keys are straight alpha ARGB */
+  indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+  for (y = 0; y < height; y++) {
+    const guint32 *row = (const guint32 *) (pixels + y * stride);
+
+    for (x = 0; x < width; x++) {
+      gpointer key = GUINT_TO_POINTER (png_unpremultiply (row[x] | opaque));
+      guint count = GPOINTER_TO_UINT (g_hash_table_lookup (indices, key));
+
+      g_hash_table_insert (indices, key, GUINT_TO_POINTER (count + 1));
+    }
+  }
+
+  colors = g_array_sized_new (FALSE, FALSE, sizeof (PngColor),
+                              g_hash_table_size (indices));
+  g_hash_table_iter_init (&iter, indices);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    PngColor color = { GPOINTER_TO_UINT (key), GPOINTER_TO_UINT (value) };
+
+    g_array_append_val (colors, color);
+  }
+  g_array_sort (colors, png_color_compare);
+
+  n_colors = MIN (colors->len, PNG_MAX_COLORS);
+  for (i = 0; i < n_colors; i++) {
+    guint32 color = g_array_index (colors, PngColor, i).color;
+
+    palette[i] = color;
+    entries[i * 3] = (color >> 16) & 0xff;
+    entries[i * 3 + 1] = (color >> 8) & 0xff;
+    entries[i * 3 + 2] = color & 0xff;
+    alphas[i] = color >> 24;
+    if (alphas[i] != 0xff)
+      n_alphas = i + 1;
+  }
+
+  /* Map every colour to its palette index, quantising the rest */
+  g_hash_table_remove_all (indices);
+  for (i = 0; i < colors->len; i++) {
+    guint32 color = g_array_index (colors, PngColor, i).color;
+    guint index;
+
+    index = i < n_colors ? i : png_closest_color (palette, n_colors, color);
+    g_hash_table_insert (indices, GUINT_TO_POINTER (color),
+                         GUINT_TO_POINTER (index));
+  }
+  g_array_free (colors, TRUE);
+
+  /* Each row starts with filter type 0, none */
+  rows = g_malloc ((width + 1) * height);
+  for (y = 0; y < height; y++) {
+    const guint32 *row = (const guint32 *) (pixels + y * stride);
+    guint8 *out = rows + y * (width + 1);
+
+    out[0] = 0;
+    for (x = 0; x < width; x++) {
+      gpointer key = GUINT_TO_POINTER (png_unpremultiply (row[x] | opaque));
+
+      out[x + 1] = GPOINTER_TO_UINT (g_hash_table_lookup (indices, key));
+    }
+  }
+  g_hash_table_destroy (indices);
+
+  idat = png_compress (rows, (width + 1) * height, level, error);
+  g_free (rows);
+  if (!idat)
+    return FALSE;
+
+  png_put_uint (header, width);
+  png_put_uint (header + 4, height);
+  header[8] = 8;   /* bit depth */
+  header[9] = 3;   /* colour type: palette */
+  header[10] = 0;  /* compression */
+  header[11] = 0;  /* filter */
+  header[12] = 0;  /* interlace */
+
+  png = g_byte_array_new ();
+  g_byte_array_append (png, png_signature, sizeof (png_signature));
+  png_append_chunk (png, "IHDR", header, sizeof (header));
+  png_append_chunk (png, "PLTE", entries, n_colors * 3);
+  if (n_alphas)
+    png_append_chunk (png, "tRNS", alphas, n_alphas);
+  png_append_chunk (png, "IDAT", g_bytes_get_data (idat, NULL),
+                    g_bytes_get_size (idat));
+  png_append_chunk (png, "IEND", NULL, 0);
+  g_bytes_unref (idat);
+
+  written = g_file_set_contents (filename, (const char *) png->data,
+                                 png->len, error);
+  g_byte_array_unref (png);
+
+  return written;
+}
@@ -0,0 +1,613 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <cairo.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "vector-tile-scanline.h"
+
+/*
+ * A scanline filler for opaque polygons, writing straight into the
+ * pixels of an image surface. It only handles what most of a tile is
+ * made of: an opaque colour drawn with the over operator onto an ARGB32
+ * or RGB24 surface, clipped to a rectangle at most. Anything else is
+ * left to cairo.
+ *
+ * Edges are kept in 16.16 fixed point in device space. Without
+ * antialiasing a pixel is filled when its centre is inside the path, as
+ * cairo does. With antialiasing only the pixels no edge passes through
+ * are filled, those cairo would cover whole, and the pixels along the
+ * edges are left for cairo to blend.
+ */
+
+#define SCANLINE_ONE (1 << 16)
+#define SCANLINE_HALF (1 << 15)
+
+/* How far an edge is taken to reach into a pixel next to it */
+#define SCANLINE_MARGIN (SCANLINE_ONE / 64)
+
+/* Device coordinates the fixed point edges can take */
+#define SCANLINE_MAX_COORD (1 << 20)
+
+/* A path segment, from top to bottom, horizontal ones included */
+typedef struct {
+  gint64 x_top;
+  gint64 y_top;
+  gint64 x_bottom;
+  gint64 y_bottom;
+  gint dir;
+} ScanlineEdge;
+
+typedef struct {
+  gint64 x;
+  gint dir;
+} ScanlineCrossing;
+
+/* Pixels of a row that an edge passes through */
+typedef struct {
+  gint x1;
+  gint x2;
+} ScanlineInterval;
+
+static gint
+scanline_edge_compare (gconstpointer data_a,
+                       gconstpointer data_b)
+{
+  const ScanlineEdge *a = data_a;
+  const ScanlineEdge *b = data_b;
+
+  return (a->y_top > b->y_top) - (a->y_top < b->y_top);
+}
+
+static gint64
+scanline_fixed (gdouble value)
+{
+  return (gint64) floor (value * SCANLINE_ONE + 0.5);
+}
+
+/* The pixel @value is in */
+static gint
+scanline_fixed_floor (gint64 value)
+{
+  return (gint) (value >> 16);
+}
+
+/* The first pixel whose centre is at or after @value */
+static gint
+scanline_fixed_center_ceil (gint64 value)
+{
+  return (gint) ((value - SCANLINE_HALF + SCANLINE_ONE - 1) >> 16);
+}
+
+static void
+scanline_add_edge (GArray *edges,
+                   gdouble x0,
+                   gdouble y0,
+                   gdouble x1,
+                   gdouble y1)
+{
+  ScanlineEdge edge;
+
+  if (x0 == x1 && y0 == y1)
+    return;
+
+  edge.dir = y0 < y1 ? 1 : (y0 > y1 ? -1 : 0);
+  if (y0 > y1) {
+    gdouble t;
+
+    t = x0; x0 = x1; x1 = t;
+    t = y0; y0 = y1; y1 = t;
+  }
+
+  edge.x_top = scanline_fixed (x0);
+  edge.y_top = scanline_fixed (y0);
+  edge.x_bottom = scanline_fixed (x1);
+  edge.y_bottom = scanline_fixed (y1);
+  g_array_append_val (edges, edge);
+}
+
+/* Where @edge is at @y, which is between its ends */
+static gint64
+scanline_edge_x (const ScanlineEdge *edge,
+                 gint64 y)
+{
+  if (edge->y_bottom == edge->y_top)
+    return edge->x_top;
+
+  return edge->x_top + (edge->x_bottom - edge->x_top) *
+    (y - edge->y_top) / (edge->y_bottom - edge->y_top);
+}
+
+/*
+ * Turn the current path of @cr into closed edges in device space, or
+ * return NULL if it reaches too far out for fixed point.
+ */
+static GArray *
+scanline_get_edges (cairo_t *cr)
+{
+  cairo_path_t *path;
+  GArray *edges;
+  gdouble start_x = 0, start_y = 0;
+  gdouble x = 0, y = 0;
+  gint i;
+
+  edges = g_array_new (FALSE, FALSE, sizeof (ScanlineEdge));
+  path = cairo_copy_path_flat (cr);
+
+  for (i = 0; i < path->num_data; i += path->data[i].header.length) {
+    cairo_path_data_t *data = &path->data[i];
+    gdouble px, py;
+
+    if (data->header.type == CAIRO_PATH_MOVE_TO ||
+        data->header.type == CAIRO_PATH_LINE_TO) {
+      px = data[1].point.x;
+      py = data[1].point.y;
+      cairo_user_to_device (cr, &px, &py);
+
+      if (fabs (px) > SCANLINE_MAX_COORD || fabs (py) > SCANLINE_MAX_COORD) {
+        cairo_path_destroy (path);
+        g_array_free (edges, TRUE);
+        return NULL;
+      }
+    }
+
+    switch (data->header.type) {
+    case CAIRO_PATH_MOVE_TO:
+      scanline_add_edge (edges, x, y, start_x, start_y);
+      start_x = x = px;
+      start_y = y = py;
+      break;
+    case CAIRO_PATH_LINE_TO:
+      scanline_add_edge (edges, x, y, px, py);
+      x = px;
+      y = py;
+      break;
+    case CAIRO_PATH_CLOSE_PATH:
+      scanline_add_edge (edges, x, y, start_x, start_y);
+      x = start_x;
+      y = start_y;
+      break;
+    default:
+      /* A flattened path has no curves */
+      break;
+    }
+  }
+  scanline_add_edge (edges, x, y, start_x, start_y);
+
+  cairo_path_destroy (path);
+  g_array_sort (edges, scanline_edge_compare);
+
+  return edges;
+}
+
+/* Find the part of @surface drawing is clipped to, FALSE if not a box */
+static gboolean
+scanline_get_clip (cairo_t *cr,
+                   cairo_surface_t *surface,
+                   cairo_rectangle_int_t *clip)
+{
+  cairo_rectangle_list_t *list;
+  gint x1, y1, x2, y2;
+
+  clip->x = 0;
+  clip->y = 0;
+  clip->width = cairo_image_surface_get_width (surface);
+  clip->height = cairo_image_surface_get_height (surface);
+
+  list = cairo_copy_clip_rectangle_list (cr);
+
+  /*
+   * Without a clip there is no list either, such a context is told
+   * apart by a point far outside of any clip still being inside it.
+   */
+  if (list->status == CAIRO_STATUS_CLIP_NOT_REPRESENTABLE) {
+    gdouble x = -1e6, y = -1e6;
+
+    cairo_rectangle_list_destroy (list);
+    cairo_device_to_user (cr, &x, &y);
+
+    return cairo_in_clip (cr, x, y);
+  }
+
+  if (list->status != CAIRO_STATUS_SUCCESS || list->num_rectangles > 1) {
+    cairo_rectangle_list_destroy (list);
+    return FALSE;
+  }
+
+  if (list->num_rectangles == 0) {
+    clip->width = clip->height = 0;
+  } else {
+    cairo_rectangle_t *rect = &list->rectangles[0];
+    gdouble rx1, ry1, rx2, ry2;
+    gdouble dx, dy;
+
+    /* The rectangle is in user space, only a box in device space too */
+    dx = 1;
+    dy = 0;
+    cairo_user_to_device_distance (cr, &dx, &dy);
+    if (dy != 0) {
+      cairo_rectangle_list_destroy (list);
+      return FALSE;
+    }
+
+    rx1 = rect->x;
+    ry1 = rect->y;
+    rx2 = rect->x + rect->width;
+    ry2 = rect->y + rect->height;
+    cairo_user_to_device (cr, &rx1, &ry1);
+    cairo_user_to_device (cr, &rx2, &ry2);
+
+    /* Only clips on pixel boundaries keep the pixels of cairo */
+    if (rx1 != floor (rx1) || ry1 != floor (ry1) ||
+        rx2 != floor (rx2) || ry2 != floor (ry2)) {
+      cairo_rectangle_list_destroy (list);
+      return FALSE;
+    }
+
+    x1 = MAX (clip->x, MIN (rx1, rx2));
+    y1 = MAX (clip->y, MIN (ry1, ry2));
+    x2 = MIN (clip->x + clip->width, MAX (rx1, rx2));
+    y2 = MIN (clip->y + clip->height, MAX (ry1, ry2));
+    clip->x = x1;
+    clip->y = y1;
+    clip->width = MAX (0, x2 - x1);
+    clip->height = MAX (0, y2 - y1);
+  }
+
+  cairo_rectangle_list_destroy (list);
+
+  return TRUE;
+}
+
+/* Kept simple so the compiler turns it into wide stores */
+static void
+scanline_fill_span (guint32 *row,
+                    gint n,
+                    guint32 pixel)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    row[i] = pixel;
+}
+
+/* As cairo turns a colour channel into a byte */
+static guint32
+scanline_channel (gdouble value)
+{
+  return ((guint32) (CLAMP (value, 0.0, 1.0) * 65535.0 + 0.5)) >> 8;
+}
+
+static gint
+scanline_crossing_compare (gconstpointer data_a,
+                           gconstpointer data_b)
+{
+  const ScanlineCrossing *a = data_a;
+  const ScanlineCrossing *b = data_b;
+
+  return (a->x > b->x) - (a->x < b->x);
+}
+
+static gint
+scanline_interval_compare (gconstpointer data_a,
+                           gconstpointer data_b)
+{
+  const ScanlineInterval *a = data_a;
+  const ScanlineInterval *b = data_b;
+
+  return (a->x1 > b->x1) - (a->x1 < b->x1);
+}
+
+/*
+ * Find the pixels of the row from @y_top to @y_bottom that the @active
+ * edges pass through, sorted and merged, into @intervals. Returns how
+ * many there are.
+ */
+static guint
+scanline_get_edge_pixels (GArray *edges,
+                          const guint *active,
+                          guint n_active,
+                          gint64 y_top,
+                          gint64 y_bottom,
+                          ScanlineInterval *intervals)
+{
+  guint i, n = 0, merged = 0;
+
+  for (i = 0; i < n_active; i++) {
+    ScanlineEdge *edge = &g_array_index (edges, ScanlineEdge, active[i]);
+    gint64 ya, yb, xa, xb;
+
+    ya = MAX (edge->y_top, y_top);
+    yb = MIN (edge->y_bottom, y_bottom);
+    if (ya > yb)
+      continue;
+
+    if (edge->y_top == edge->y_bottom) {
+      xa = edge->x_top;
+      xb = edge->x_bottom;
+    } else {
+      xa = scanline_edge_x (edge, ya);
+      xb = scanline_edge_x (edge, yb);
+    }
+
+    intervals[n].x1 = scanline_fixed_floor (MIN (xa, xb) - SCANLINE_MARGIN);
+    intervals[n].x2 = scanline_fixed_floor (MAX (xa, xb) + SCANLINE_MARGIN) + 1;
+    n++;
+  }
+
+  if (n == 0)
+    return 0;
+
+  qsort (intervals, n, sizeof (ScanlineInterval), scanline_interval_compare);
+
+  for (i = 1; i < n; i++) {
+    if (intervals[i].x1 <= intervals[merged].x2)
+      intervals[merged].x2 = MAX (intervals[merged].x2, intervals[i].x2);
+    else
+      intervals[++merged] = intervals[i];
+  }
+
+  return merged + 1;
+}
+
+/*
+ * Fill the pixels of @row from @x1 to @x2 but those in the @n_intervals
+ * edge @intervals, moving *@next past the intervals left behind.
+ */
+static void
+scanline_fill_between (guint32 *row,
+                       gint x1,
+                       gint x2,
+                       const ScanlineInterval *intervals,
+                       guint n_intervals,
+                       guint *next,
+                       guint32 pixel)
+{
+  while (x1 < x2) {
+    gint end = x2;
+
+    while (*next < n_intervals && intervals[*next].x2 <= x1)
+      (*next)++;
+
+    if (*next < n_intervals) {
+      if (intervals[*next].x1 <= x1) {
+        x1 = intervals[*next].x2;
+        continue;
+      }
+      end = MIN (end, intervals[*next].x1);
+    }
+
+    scanline_fill_span (row + x1, end - x1, pixel);
+    x1 = end;
+  }
+}
+
+/*
+ * Clip @cr to @rects, in device space, keeping the current path as it
+ * is.
+ */
+static void
+scanline_clip_to_rects (cairo_t *cr,
+                        GArray *rects)
+{
+  cairo_path_t *path;
+  cairo_matrix_t matrix;
+  guint i;
+
+  path = cairo_copy_path (cr);
+  cairo_get_matrix (cr, &matrix);
+
+  cairo_new_path (cr);
+  cairo_identity_matrix (cr);
+  for (i = 0; i < rects->len; i++) {
+    cairo_rectangle_int_t *rect;
+
+    rect = &g_array_index (rects, cairo_rectangle_int_t, i);
+    cairo_rectangle (cr, rect->x, rect->y, rect->width, rect->height);
+  }
+  cairo_clip (cr);
+
+  cairo_set_matrix (cr, &matrix);
+  cairo_append_path (cr, path);
+  cairo_path_destroy (path);
+}
+
+/*
+ * Fill the current path of @cr with the opaque colour @r, @g, @b,
+ * straight into the pixels of the target.
+ *
+ * Returns %VTILE_SCANLINE_UNHANDLED, leaving the path alone, if the
+ * fill is not one the scanline filler handles, then it is up to cairo.
+ * Without antialiasing the whole path is filled, the path is used up
+ * and %VTILE_SCANLINE_FILLED is returned. With antialiasing only the
+ * pixels the path covers whole are filled, @cr is clipped to the pixels
+ * along its edges and %VTILE_SCANLINE_EDGES is returned, the path left
+ * for the caller to fill with cairo. Call this between cairo_save() and
+ * cairo_restore() to drop that clip again.
+ */
+VTileScanlineResult
+vtile_scanline_fill (cairo_t *cr,
+                     gdouble r,
+                     gdouble g,
+                     gdouble b)
+{
+  cairo_surface_t *surface;
+  cairo_format_t format;
+  cairo_rectangle_int_t clip;
+  gdouble x_offset, y_offset;
+  gboolean even_odd, antialias;
+  GArray *edges;
+  GArray *edge_rects = NULL;
+  ScanlineCrossing *crossings;
+  ScanlineInterval *intervals = NULL;
+  guint *active;
+  guint n_active = 0;
+  guint next = 0;
+  guint32 pixel;
+  guchar *data;
+  gint stride;
+  gint y, y_end;
+  gint dirty_x1 = G_MAXINT, dirty_x2 = G_MININT;
+
+  surface = cairo_get_group_target (cr);
+  if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+      cairo_get_operator (cr) != CAIRO_OPERATOR_OVER)
+    return VTILE_SCANLINE_UNHANDLED;
+
+  format = cairo_image_surface_get_format (surface);
+  if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+    return VTILE_SCANLINE_UNHANDLED;
+
+  cairo_surface_get_device_offset (surface, &x_offset, &y_offset);
+  if (x_offset != 0 || y_offset != 0)
+    return VTILE_SCANLINE_UNHANDLED;
+
+  if (!scanline_get_clip (cr, surface, &clip))
+    return VTILE_SCANLINE_UNHANDLED;
+
+  edges = scanline_get_edges (cr);
+  if (!edges)
+    return VTILE_SCANLINE_UNHANDLED;
+
+  antialias = cairo_get_antialias (cr) != CAIRO_ANTIALIAS_NONE;
+  even_odd = cairo_get_fill_rule (cr) == CAIRO_FILL_RULE_EVEN_ODD;
+
+  if (edges->len == 0 || clip.width == 0 || clip.height == 0) {
+    g_array_free (edges, TRUE);
+    cairo_new_path (cr);
+    return VTILE_SCANLINE_FILLED;
+  }
+
+  pixel = 0xff000000 |
+    scanline_channel (r) << 16 |
+    scanline_channel (g) << 8 |
+    scanline_channel (b);
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  crossings = g_new (ScanlineCrossing, edges->len);
+  active = g_new (guint, edges->len);
+  if (antialias) {
+    intervals = g_new (ScanlineInterval, edges->len);
+    edge_rects = g_array_new (FALSE, FALSE, sizeof (cairo_rectangle_int_t));
+  }
+
+  y = MAX (clip.y, scanline_fixed_floor (g_array_index (edges, ScanlineEdge,
+                                                        0).y_top -
+                                         SCANLINE_MARGIN));
+  y_end = clip.y + clip.height;
+
+  for (; y < y_end && (next < edges->len || n_active > 0); y++) {
+    gint64 row_top = (gint64) y * SCANLINE_ONE - SCANLINE_MARGIN;
+    gint64 row_bottom = (gint64) (y + 1) * SCANLINE_ONE + SCANLINE_MARGIN;
+    gint64 center = (gint64) y * SCANLINE_ONE + SCANLINE_HALF;
+    guint32 *row = (guint32 *) (data + y * stride);
+    guint n_crossings = 0, n_intervals = 0, next_interval = 0;
+    gint winding = 0;
+    gint64 span_start = 0;
+    guint i, kept = 0;
+
+    while (next < edges->len &&
+           g_array_index (edges, ScanlineEdge, next).y_top <= row_bottom)
+      active[n_active++] = next++;
+
+    for (i = 0; i < n_active; i++) {
+      ScanlineEdge *edge = &g_array_index (edges, ScanlineEdge, active[i]);
+
+      if (edge->y_bottom < row_top)
+        continue;
+
+      active[kept++] = active[i];
+      if (edge->y_top <= center && center < edge->y_bottom) {
+        crossings[n_crossings].x = scanline_edge_x (edge, center);
+        crossings[n_crossings].dir = edge->dir;
+        n_crossings++;
+      }
+    }
+    n_active = kept;
+
+    if (antialias) {
+      n_intervals = scanline_get_edge_pixels (edges, active, n_active,
+                                              row_top, row_bottom,
+                                              intervals);
+
+      for (i = 0; i < n_intervals; i++) {
+        cairo_rectangle_int_t rect;
+
+        rect.x = MAX (clip.x, intervals[i].x1);
+        rect.width = MIN (clip.x + clip.width, intervals[i].x2) - rect.x;
+        rect.y = y;
+        rect.height = 1;
+        if (rect.width > 0)
+          g_array_append_val (edge_rects, rect);
+      }
+    }
+
+    qsort (crossings, n_crossings, sizeof (ScanlineCrossing),
+           scanline_crossing_compare);
+
+    for (i = 0; i < n_crossings; i++) {
+      gboolean was_inside, inside;
+
+      was_inside = even_odd ? (winding & 1) : winding != 0;
+      winding += even_odd ? 1 : crossings[i].dir;
+      inside = even_odd ? (winding & 1) : winding != 0;
+
+      if (!was_inside && inside) {
+        span_start = crossings[i].x;
+      } else if (was_inside && !inside) {
+        gint x1, x2;
+
+        /* The pixels whose centres are in [span_start, x) */
+        x1 = MAX (clip.x, scanline_fixed_center_ceil (span_start));
+        x2 = MIN (clip.x + clip.width,
+                  scanline_fixed_center_ceil (crossings[i].x));
+        if (x1 < x2) {
+          scanline_fill_between (row, x1, x2, intervals, n_intervals,
+                                 &next_interval, pixel);
+          dirty_x1 = MIN (dirty_x1, x1);
+          dirty_x2 = MAX (dirty_x2, x2);
+        }
+      }
+    }
+  }
+
+  if (dirty_x1 < dirty_x2)
+    cairo_surface_mark_dirty_rectangle (surface, dirty_x1, clip.y,
+                                        dirty_x2 - dirty_x1, clip.height);
+
+  g_free (active);
+  g_free (crossings);
+  g_free (intervals);
+  g_array_free (edges, TRUE);
+
+  if (!antialias || edge_rects->len == 0) {
+    if (edge_rects)
+      g_array_free (edge_rects, TRUE);
+    cairo_new_path (cr);
+    return VTILE_SCANLINE_FILLED;
+  }
+
+  scanline_clip_to_rects (cr, edge_rects);
+  g_array_free (edge_rects, TRUE);
+
+  return VTILE_SCANLINE_EDGES;
+}
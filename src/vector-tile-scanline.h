@@ -0,0 +1,39 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_SCANLINE_H__
+#define __VECTOR_TILE_SCANLINE_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  VTILE_SCANLINE_UNHANDLED,
+  VTILE_SCANLINE_FILLED,
+  VTILE_SCANLINE_EDGES
+} VTileScanlineResult;
+
+VTileScanlineResult vtile_scanline_fill (cairo_t *cr,
+                                         gdouble r,
+                                         gdouble g,
+                                         gdouble b);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_SCANLINE_H__ */
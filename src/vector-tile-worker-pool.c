@@ -0,0 +1,175 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "vector-tile-worker-pool.h"
+
+/*
+ * A small fork/join helper shared by the renderers. The jobs of a batch
+ * are numbered 0 to n_jobs - 1 and claimed with an atomic counter, both
+ * by the pool threads and by the thread calling vtile_worker_pool_run().
+ * Since the caller keeps claiming jobs itself a batch always completes,
+ * even when every pool thread is busy with batches from other renders.
+ */
+typedef struct {
+  volatile gint ref_count;
+  volatile gint next_job;
+
+  guint n_jobs;
+  guint n_done;
+  VTileWorkerFunc func;
+  gpointer user_data;
+
+  GMutex lock;
+  GCond cond;
+} WorkerBatch;
+
+static GThreadPool *pool = NULL;
+static guint n_workers = 0;
+
+static void
+worker_batch_unref (WorkerBatch *batch)
+{
+  if (!g_atomic_int_dec_and_test (&batch->ref_count))
+    return;
+
+  g_mutex_clear (&batch->lock);
+  g_cond_clear (&batch->cond);
+  g_free (batch);
+}
+
+static void
+worker_batch_work (WorkerBatch *batch)
+{
+  guint job;
+  guint done = 0;
+
+  while ((job = g_atomic_int_add (&batch->next_job, 1)) < batch->n_jobs) {
+    batch->func (job, batch->user_data);
+    done++;
+  }
+
+  if (!done)
+    return;
+
+  g_mutex_lock (&batch->lock);
+  batch->n_done += done;
+  if (batch->n_done == batch->n_jobs)
+    g_cond_signal (&batch->cond);
+  g_mutex_unlock (&batch->lock);
+}
+
+static void
+worker_pool_thread (WorkerBatch *batch,
+                    gpointer user_data)
+{
+  worker_batch_work (batch);
+  worker_batch_unref (batch);
+}
+
+static gpointer
+worker_pool_init (gpointer data)
+{
+  guint n_processors = g_get_num_processors ();
+  const gchar *threads;
+
+  /* The calling thread does its share of the work */
+  n_workers = n_processors > 1 ? n_processors - 1 : 0;
+
+  /* Lets the tests run the parallel paths on single core machines too */
+  threads = g_getenv ("VTILE_WORKER_THREADS");
+  if (threads)
+    n_workers = (guint) g_ascii_strtoull (threads, NULL, 10);
+
+  if (n_workers > 0)
+    pool = g_thread_pool_new ((GFunc) worker_pool_thread, NULL,
+                              n_workers, FALSE, NULL);
+
+  return NULL;
+}
+
+static void
+worker_pool_ensure (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, worker_pool_init, NULL);
+}
+
+/*
+ * Returns the number of threads, besides the calling one, that can
+ * pick up jobs. This is 0 on single core machines.
+ */
+guint
+vtile_worker_pool_get_n_workers (void)
+{
+  worker_pool_ensure ();
+
+  return n_workers;
+}
+
+/*
+ * Call @func once for every job in 0 to @n_jobs - 1, spread over the
+ * pool threads and the calling thread, and wait for all of them to
+ * finish. Jobs may run in any order and at the same time.
+ */
+void
+vtile_worker_pool_run (guint n_jobs,
+                       VTileWorkerFunc func,
+                       gpointer user_data)
+{
+  WorkerBatch *batch;
+  guint n_helpers;
+  guint i;
+
+  g_return_if_fail (func != NULL);
+
+  if (n_jobs == 0)
+    return;
+
+  worker_pool_ensure ();
+
+  n_helpers = MIN (n_workers, n_jobs - 1);
+  if (n_helpers == 0) {
+    for (i = 0; i < n_jobs; i++)
+      func (i, user_data);
+    return;
+  }
+
+  batch = g_new0 (WorkerBatch, 1);
+  batch->ref_count = 1;
+  batch->n_jobs = n_jobs;
+  batch->func = func;
+  batch->user_data = user_data;
+  g_mutex_init (&batch->lock);
+  g_cond_init (&batch->cond);
+
+  for (i = 0; i < n_helpers; i++) {
+    g_atomic_int_inc (&batch->ref_count);
+    g_thread_pool_push (pool, batch, NULL);
+  }
+
+  worker_batch_work (batch);
+
+  g_mutex_lock (&batch->lock);
+  while (batch->n_done < batch->n_jobs)
+    g_cond_wait (&batch->cond, &batch->lock);
+  g_mutex_unlock (&batch->lock);
+
+  worker_batch_unref (batch);
+}
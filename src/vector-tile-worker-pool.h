@@ -0,0 +1,36 @@
+/*
+ * Copyright 2015 Jonas Danielsson <jonas@threetimestwo.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with vector-tile-glib; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VECTOR_TILE_WORKER_POOL_H__
+#define __VECTOR_TILE_WORKER_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef void (*VTileWorkerFunc) (guint job,
+                                 gpointer user_data);
+
+guint vtile_worker_pool_get_n_workers (void);
+
+void vtile_worker_pool_run (guint n_jobs,
+                            VTileWorkerFunc func,
+                            gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __VECTOR_TILE_WORKER_POOL_H__ */
@@ -5,11 +5,14 @@
 #include "vector-tile-mapbox.h"
 #include "vector-tile-mapcss.h"
 #include "vector-tile-mapcss-style.h"
+#include "vector-tile-png.h"
 
 static char *output;
 static char **input = NULL;
 static guint tile_size;
 static guint zoom_level;
+static gboolean indexed;
+static gint compression = G_MININT;
 
 static GOptionEntry entries[] =
   {
@@ -19,6 +22,10 @@ static GOptionEntry entries[] =
       "The zoom-level of the tile, default: 0", NULL },
     { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
       "Output PNG filename, default: 'image.png'", NULL },
+    { "indexed", 'i', 0, G_OPTION_ARG_NONE, &indexed,
+      "Write an 8-bit paletted PNG", NULL },
+    { "compression", 'c', 0, G_OPTION_ARG_INT, &compression,
+      "Compression level of paletted PNGs, 0-9, default: 6", NULL },
     { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &input,
       "The tile to render", NULL },
     { NULL },
@@ -62,6 +69,13 @@ main (int argc, char **argv)
   if (!tile_size)
     tile_size = 256;
 
+  if (compression == G_MININT)
+    compression = 6;
+  if (compression < 0 || compression > 9) {
+    g_print ("The compression level goes from 0 to 9\n");
+    exit (1);
+  }
+
   file = g_file_new_for_path (input[0]);
   info = g_file_query_info (file,
                             G_FILE_ATTRIBUTE_STANDARD_SIZE,
@@ -113,6 +127,11 @@ main (int argc, char **argv)
 
   if (!vtile_mapbox_render (mapbox, cr, NULL)) {
     g_print ("Failed to render!\n");
+  } else if (indexed) {
+    if (!vtile_png_write_indexed (surface, output, compression, &error)) {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
   } else {
     cairo_surface_write_to_png (surface, output);
   }